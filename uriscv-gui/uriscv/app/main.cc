@@ -1,19 +1,33 @@
 #include "gdb/gdb.h"
 #include "uriscv/config.h"
+#include "uriscv/device.h"
 #include "uriscv/error.h"
+#include "uriscv/jit.h"
 #include "uriscv/machine.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/processor.h"
 #include "uriscv/stoppoint.h"
 #include "uriscv/symbol_table.h"
+#include "uriscv/systembus.h"
 #include "uriscv/utility.h"
+#include <algorithm>
 #include <boost/program_options.hpp>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <poll.h>
+#include <set>
+#include <sstream>
 #include <string>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
 
 namespace po = boost::program_options;
 
@@ -26,6 +40,342 @@ bool fileExists(const char *filename) {
   return (stat(filename, &buf) == 0);
 }
 
+// This function runs the machine for iter cycles (forever if unlimited),
+// until it halts or it stops on a stoppoint; it returns true in the
+// latter case
+static bool runMachine(Machine *mac, bool unlimited, int iter) {
+  // Step in chunks, so that the machine can run instructions in
+  // blocks (and translated code) between calls; cycles during which
+  // all processors are idle (waiting for an interrupt) are skipped
+  // in one go
+  const unsigned int kStepsPerCall = 100000;
+  bool stopped = false;
+  while (unlimited || iter > 0) {
+    uint32_t idle = mac->idleCycles();
+    if (idle > 0) {
+      if (!unlimited && (unsigned int)iter < idle)
+        idle = iter;
+      mac->skip(idle);
+      if (!unlimited)
+        iter -= idle;
+      continue;
+    }
+
+    unsigned int steps = kStepsPerCall;
+    if (!unlimited && (unsigned int)iter < steps)
+      steps = iter;
+    uint32_t stepped = mac->run(steps, &stopped);
+    if (stopped)
+      return true;
+    if (!unlimited)
+      iter -= std::max(stepped, 1U);
+    if (mac->IsHalted())
+      break;
+  }
+  return false;
+}
+
+// This function runs the machine as runMachine() does, writing a
+// checkpoint every interval cycles to prefix.0, prefix.1 and so on; the
+// first one is a full snapshot, and each of the others only holds the
+// memory written since the one before
+static bool runWithCheckpoints(Machine *mac, bool unlimited, int iter,
+                               int interval, const std::string &prefix) {
+  std::string parent;
+  bool stopped = false;
+  for (unsigned int n = 0; !stopped && (unlimited || iter > 0); n++) {
+    int cycles = interval;
+    if (!unlimited && iter < cycles)
+      cycles = iter;
+    stopped = runMachine(mac, false, cycles);
+    if (!unlimited)
+      iter -= cycles;
+
+    std::string name = prefix + "." + std::to_string(n);
+    try {
+      mac->Checkpoint(name, parent);
+    } catch (const Error &e) {
+      Panic(e.what());
+    }
+    parent = name.substr(name.rfind('/') + 1);
+    if (mac->IsHalted())
+      break;
+  }
+
+  try {
+    mac->FinishCheckpoint();
+  } catch (const Error &e) {
+    Panic(e.what());
+  }
+  return stopped;
+}
+
+// This function runs the machine up to the fork point: point is either
+// a cycle count or the name of a symbol, in which case the machine runs
+// until a processor is about to execute its first instruction
+static void runToForkPoint(Machine *mac, SymbolTable *stab,
+                           StoppointSet *breakpoints,
+                           const std::string &point) {
+  if (point.find_first_not_of("0123456789") == std::string::npos) {
+    runMachine(mac, false, atoi(point.c_str()));
+    return;
+  }
+
+  const Symbol *symbol = NULL;
+  for (unsigned int i = 0; i < stab->Size() && symbol == NULL; i++)
+    if (point == stab->Get(i)->getName())
+      symbol = stab->Get(i);
+  if (symbol == NULL)
+    Panic(("Unknown fork point symbol: " + point).c_str());
+
+  breakpoints->Add(AddressRange(MachineConfig::MAX_ASID, symbol->getStart(),
+                                symbol->getStart()),
+                   AM_EXEC);
+  mac->setStopMask(SC_BREAKPOINT);
+  bool stopped = runMachine(mac, true, 0);
+  mac->setStopMask(0);
+
+  // Remove() (unlike Clear()) lets the machine map the page of the
+  // breakpoint again
+  Stoppoint *sp =
+      breakpoints->Find(MachineConfig::MAX_ASID, symbol->getStart());
+  breakpoints->Remove(sp->getIndex());
+  if (!stopped)
+    Panic(("Machine halted before reaching " + point).c_str());
+}
+
+// A variant is a named set of device settings applied to a forked copy
+// of the machine: "devname=file" switches a device to another host
+// file, "fail=devname" makes it fail all operations
+struct Variant {
+  std::string name;
+  std::vector<std::string> settings;
+};
+
+// This function reads the variants file: one variant per line, made of
+// its name followed by its settings; empty lines and lines starting
+// with '#' are ignored
+static std::vector<Variant> loadVariants(const std::string &fileName) {
+  std::ifstream in(fileName.c_str());
+  if (in.fail())
+    Panic(("Cannot open variants file " + fileName).c_str());
+
+  std::vector<Variant> variants;
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    Variant variant;
+    if (!(fields >> variant.name) || variant.name[0] == '#')
+      continue;
+    std::string setting;
+    while (fields >> setting)
+      variant.settings.push_back(setting);
+    variants.push_back(variant);
+  }
+  return variants;
+}
+
+static Device *variantDevice(Machine *mac, const std::string &name) {
+  unsigned int il, devNo;
+  if (!MachineConfig::ParseDeviceName(name, &il, &devNo))
+    Panic(("Unknown device in variant: " + name).c_str());
+  return mac->getDevice(il, devNo);
+}
+
+static bool isBlockDevice(unsigned int il) {
+  return il == EXT_IL_INDEX(IL_DISK) || il == EXT_IL_INDEX(IL_FLASH);
+}
+
+// Disk and flash images are written in place: this function refuses
+// variants that would set two devices, or the devices of two variants,
+// to the same image, or a device to one of the machine's own images
+static void checkVariantImages(const MachineConfig *config,
+                               const std::vector<Variant> &variants) {
+  std::set<std::string> images;
+  for (unsigned int il = 0; il < N_EXT_IL; il++)
+    for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++)
+      if (isBlockDevice(il) && config->getDeviceEnabled(il, devNo))
+        images.insert(config->getDeviceFile(il, devNo));
+
+  for (const Variant &variant : variants)
+    for (const std::string &setting : variant.settings) {
+      size_t sep = setting.find('=');
+      unsigned int il, devNo;
+      if (sep == std::string::npos ||
+          !MachineConfig::ParseDeviceName(setting.substr(0, sep), &il,
+                                          &devNo) ||
+          !isBlockDevice(il))
+        continue;
+      if (!images.insert(setting.substr(sep + 1)).second)
+        Panic(("Image shared by variant " + variant.name + ": " +
+               setting.substr(sep + 1))
+                  .c_str());
+    }
+}
+
+// This function copies a disk or flash image
+static void copyImage(const std::string &from, const std::string &to) {
+  std::ifstream in(from.c_str(), std::ios::binary);
+  std::ofstream out(to.c_str(), std::ios::binary | std::ios::trunc);
+  if (in.fail() || out.fail() || !(out << in.rdbuf()) || !out.flush())
+    Panic(("Cannot copy image " + from + " to " + to).c_str());
+}
+
+// This function applies a variant to the (forked) machine; the logs of
+// printers and terminals the variant does not set are moved to a file
+// of their own, named after the variant. So are disk and flash images,
+// which are copied there first: the child would otherwise write to the
+// parent's image, through a file offset shared with the other children
+static void applyVariant(Machine *mac, const MachineConfig *config,
+                         const Variant &variant) {
+  std::map<Device *, std::string> files, images;
+  for (unsigned int il = 0; il < N_EXT_IL; il++) {
+    if (il != EXT_IL_INDEX(IL_PRINTER) && il != EXT_IL_INDEX(IL_TERMINAL) &&
+        !isBlockDevice(il))
+      continue;
+    for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
+      if (!config->getDeviceEnabled(il, devNo))
+        continue;
+      Device *device = mac->getDevice(il, devNo);
+      files[device] = config->getDeviceFile(il, devNo) + "." + variant.name;
+      if (isBlockDevice(il))
+        images[device] = config->getDeviceFile(il, devNo);
+    }
+  }
+
+  for (const std::string &setting : variant.settings) {
+    size_t sep = setting.find('=');
+    if (sep == std::string::npos)
+      Panic(("Invalid variant setting: " + setting).c_str());
+    std::string key = setting.substr(0, sep);
+    std::string value = setting.substr(sep + 1);
+    if (key == "fail") {
+      Device *device = variantDevice(mac, value);
+      mac->getBus()->setDeviceCondition(device->getInterruptLine(),
+                                        device->getNumber(), false);
+    }
+    else {
+      Device *device = variantDevice(mac, key);
+      files[device] = value;
+      images.erase(device);
+    }
+  }
+
+  for (auto &file : files) {
+    std::map<Device *, std::string>::const_iterator it =
+        images.find(file.first);
+    if (it != images.end())
+      copyImage(it->second, file.second);
+    file.first->setFile(file.second);
+  }
+}
+
+// A forked variant run, as seen by the parent
+struct VariantRun {
+  const Variant *variant;
+  pid_t pid;
+  int fd;
+  std::string output;
+};
+
+// This function forks a copy-on-write child per variant, at most jobs at
+// a time, each one running its variant from the current machine state;
+// the output of each child is collected and printed by the parent when
+// the child is done. It returns true if all of them succeeded
+static bool forkVariants(Machine *mac, const MachineConfig *config,
+                         const std::vector<Variant> &variants,
+                         unsigned int jobs, bool parallel, bool unlimited,
+                         int iter, const std::string &saveFile) {
+  std::vector<VariantRun> running;
+  size_t next = 0;
+  bool success = true;
+
+  while (next < variants.size() || !running.empty()) {
+    while (next < variants.size() && running.size() < jobs) {
+      const Variant &variant = variants[next++];
+      int fds[2];
+      if (pipe(fds) == -1)
+        Panic(strerror(errno));
+
+      // Anything buffered would be written by both processes
+      fflush(NULL);
+      pid_t pid = fork();
+      if (pid == -1)
+        Panic(strerror(errno));
+
+      if (pid == 0) {
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        for (const VariantRun &run : running)
+          close(run.fd);
+
+        // Worker threads are not inherited: they may only be started
+        // after the fork
+        PARALLEL = parallel;
+        applyVariant(mac, config, variant);
+        if (runMachine(mac, unlimited, iter))
+          Panic("Error in step\n");
+        if (!saveFile.empty()) {
+          try {
+            mac->Save(saveFile + "." + variant.name);
+          } catch (const Error &e) {
+            Panic(e.what());
+          }
+        }
+        fflush(NULL);
+        _exit(EXIT_SUCCESS);
+      }
+
+      close(fds[1]);
+      VariantRun run = {&variant, pid, fds[0], std::string()};
+      running.push_back(run);
+    }
+
+    std::vector<pollfd> pfds(running.size());
+    for (size_t i = 0; i < running.size(); i++) {
+      pfds[i].fd = running[i].fd;
+      pfds[i].events = POLLIN;
+    }
+    if (poll(&pfds[0], pfds.size(), -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      Panic(strerror(errno));
+    }
+
+    for (size_t i = running.size(); i-- > 0;) {
+      if (!pfds[i].revents)
+        continue;
+      char buf[4096];
+      ssize_t n = read(running[i].fd, buf, sizeof(buf));
+      if (n > 0) {
+        running[i].output.append(buf, n);
+        continue;
+      }
+      if (n == -1 && errno == EINTR)
+        continue;
+
+      // The child closed its output: collect it
+      int status;
+      close(running[i].fd);
+      while (waitpid(running[i].pid, &status, 0) == -1 && errno == EINTR)
+        ;
+      bool ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+      if (!ok)
+        success = false;
+      std::cout << "=== " << running[i].variant->name << ": ";
+      if (WIFEXITED(status))
+        std::cout << "exit status " << WEXITSTATUS(status);
+      else
+        std::cout << "killed by signal " << WTERMSIG(status);
+      std::cout << " ===\n" << running[i].output << std::flush;
+      running.erase(running.begin() + i);
+    }
+  }
+  return success;
+}
+
 int main(int argc, char **argv) {
 
   po::positional_options_description p;
@@ -36,7 +386,29 @@ int main(int argc, char **argv) {
   desc.add_options()("help", "show this help")(
       "config", po::value<std::string>()->default_value(defFileName))(
       "debug", "enable debug")("disass", "enable disassembler")(
-      "iter", po::value<int>(), "iterations")("gdb", "start gdb server");
+      "iter", po::value<int>(), "iterations")("gdb", "start gdb server")(
+      "jit", "enable the JIT compiler")(
+      "jit-check", "run the JIT compiler against the interpreter")(
+      "parallel", "run processors on separate host threads (not "
+                  "reproducible)")(
+      "restore", po::value<std::string>(),
+      "start from the machine state saved in a snapshot file")(
+      "save", po::value<std::string>(),
+      "save the machine state to a snapshot file when the run ends")(
+      "variants", po::value<std::string>(),
+      "run each variant listed in a file in a forked copy of the machine")(
+      "fork-at", po::value<std::string>()->default_value("0"),
+      "cycle count or symbol to run to before forking the variants")(
+      "jobs", po::value<unsigned int>(),
+      "number of variants to run at the same time")(
+      "checkpoint", po::value<std::string>(),
+      "write checkpoints to files named after this one, numbered from 0")(
+      "checkpoint-every", po::value<int>()->default_value(100000000),
+      "cycles between checkpoints")(
+      "record", po::value<std::string>(),
+      "record terminal input and device failures to a file")(
+      "replay", po::value<std::string>(),
+      "replay the inputs recorded to a file at the same clock ticks");
 
   po::variables_map vm;
   po::store(
@@ -61,17 +433,52 @@ int main(int argc, char **argv) {
   if (error != "")
     Panic(error.c_str());
 
+  if (vm.count("jit") || vm.count("jit-check")) {
+    JIT = true;
+    JITCHECK = vm.count("jit-check");
+    if (!Jit::IsSupported())
+      std::cerr << "JIT compiler not supported on this host\n";
+  }
+
   SymbolTable *stab;
   stab = new SymbolTable(config->getSymbolTableASID(),
                          config->getROM(ROM_TYPE_STAB).c_str());
-  Machine *mac = new Machine(config, NULL, NULL, NULL);
+  StoppointSet *breakpoints = NULL;
+  StoppointSet *suspects = NULL;
+  if (vm.count("variants") || vm.count("gdb"))
+    breakpoints = new StoppointSet();
+  // gdb watchpoints are machine suspects
+  if (vm.count("gdb"))
+    suspects = new StoppointSet();
+  Machine *mac = new Machine(config, breakpoints, suspects, NULL);
   mac->setStab(stab);
 
+  if (vm.count("restore")) {
+    try {
+      mac->Restore(vm["restore"].as<std::string>());
+    } catch (const Error &e) {
+      Panic(e.what());
+    }
+  }
+
+  if (vm.count("record") && vm.count("replay"))
+    Panic("Inputs cannot be recorded and replayed at the same time");
+  try {
+    if (vm.count("record"))
+      mac->getBus()->RecordInputs(vm["record"].as<std::string>());
+    else if (vm.count("replay"))
+      mac->getBus()->ReplayInputs(vm["replay"].as<std::string>());
+  } catch (const Error &e) {
+    Panic(e.what());
+  }
+
   int iter = -1;
   if (vm.count("debug"))
     DEBUG = true;
   if (vm.count("disass"))
     DISASS = true;
+  if (vm.count("parallel"))
+    PARALLEL = true;
 
   bool unlimited = false;
   if (vm.count("iter"))
@@ -79,16 +486,50 @@ int main(int argc, char **argv) {
   else
     unlimited = true;
 
+  if (vm.count("variants")) {
+    if (vm.count("gdb"))
+      Panic("Variants cannot be run under the gdb server");
+    if (vm.count("record"))
+      Panic("Inputs cannot be recorded from variants");
+    if (vm.count("replay"))
+      Panic("Inputs cannot be replayed into variants");
+    std::vector<Variant> variants =
+        loadVariants(vm["variants"].as<std::string>());
+    checkVariantImages(config, variants);
+    unsigned int jobs = std::max(std::thread::hardware_concurrency(), 1U);
+    if (vm.count("jobs"))
+      jobs = std::max(vm["jobs"].as<unsigned int>(), 1U);
+    std::string saveFile;
+    if (vm.count("save"))
+      saveFile = vm["save"].as<std::string>();
+
+    // Boot once, then let each variant continue from there; worker
+    // threads are left to the children
+    PARALLEL = false;
+    runToForkPoint(mac, stab, breakpoints, vm["fork-at"].as<std::string>());
+    bool success = forkVariants(mac, config, variants, jobs,
+                                vm.count("parallel"), unlimited, iter,
+                                saveFile);
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
   if (vm.count("gdb")) {
-    GDBServer *gdb = new GDBServer(mac);
+    GDBServer *gdb = new GDBServer(mac, breakpoints, suspects);
     gdb->StartServer();
-  } else {
-    bool stopped = false;
-    for (int i = 0; i < iter || unlimited; i++) {
-      mac->step(&stopped);
-      if (stopped) {
-        Panic("Error in step\n");
-      }
+  } else if (vm.count("checkpoint")) {
+    if (runWithCheckpoints(mac, unlimited, iter,
+                           std::max(vm["checkpoint-every"].as<int>(), 1),
+                           vm["checkpoint"].as<std::string>()))
+      Panic("Error in step\n");
+  } else if (runMachine(mac, unlimited, iter)) {
+    Panic("Error in step\n");
+  }
+
+  if (vm.count("save")) {
+    try {
+      mac->Save(vm["save"].as<std::string>());
+    } catch (const Error &e) {
+      Panic(e.what());
     }
   }
   return EXIT_SUCCESS;
@@ -22,8 +22,10 @@
 #include "qriscv/application.h"
 
 #include <cassert>
+#include <cstring>
 
 #include <QDir>
+#include <QFile>
 #include <QFileInfo>
 #include <QMessageBox>
 
@@ -40,8 +42,14 @@ Application::Application(int &argc, char **argv)
   monitorWindow.reset(new MonitorWindow);
   monitorWindow->show();
 
-  if (argc > 1)
-    LoadConfig(argv[1]);
+  // Usage: uriscv [--record-inputs FILE] [CONFIG]
+  int i = 1;
+  if (i + 1 < argc && !strcmp(argv[i], "--record-inputs")) {
+    inputLogFile = QFile::decodeName(argv[i + 1]);
+    i += 2;
+  }
+  if (i < argc)
+    LoadConfig(argv[i]);
 }
 
 Application::~Application() {}
@@ -26,11 +26,13 @@
 #include <list>
 
 #include <QAction>
+#include <QFile>
 #include <QMessageBox>
 #include <QTimer>
 
 #include "qriscv/application.h"
 #include "uriscv/error.h"
+#include "uriscv/systembus.h"
 
 const unsigned int DebugSession::kIterCycles[kNumSpeedLevels] = {5, 25, 250,
                                                                  2500, 20000};
@@ -234,6 +236,19 @@ void DebugSession::initializeMachine() {
 
   machine->setStopMask(stopMask);
 
+  const QString &inputLogFile = Appl()->getInputLogFile();
+  if (!inputLogFile.isEmpty()) {
+    try {
+      machine->getBus()->RecordInputs(
+          QFile::encodeName(inputLogFile).constData());
+    } catch (const FileError &e) {
+      QMessageBox::warning(
+          Appl()->getApplWindow(),
+          QString("%1: Warning").arg(Appl()->applicationName()),
+          QString("Could not record inputs to `%1'").arg(e.fileName.c_str()));
+    }
+  }
+
   SymbolTable *stab;
   try {
     stab = new SymbolTable(config->getSymbolTableASID(),
@@ -350,7 +365,7 @@ void DebugSession::step(unsigned int steps) {
   // Always step through at least one cycle (might be a bit too
   // pedantic but oh well...)
   bool stopped;
-  machine->step(&stopped);
+  machine->run(1, &stopped);
   --stepsLeft;
 
   if (machine->IsHalted()) {
@@ -375,9 +390,7 @@ void DebugSession::runStepIteration() {
   unsigned int steps = std::min(stepsLeft, kIterCycles[speed]);
 
   bool stopped = false;
-  unsigned int stepped;
-  machine->step(steps, &stepped, &stopped);
-  stepsLeft -= stepped;
+  stepsLeft -= machine->run(steps, &stopped);
 
   if (machine->IsHalted()) {
     halt();
@@ -403,7 +416,7 @@ void DebugSession::runContIteration() {
     idleTimer->start(interval);
   } else {
     bool stopped;
-    machine->step(kIterCycles[speed], NULL, &stopped);
+    machine->run(kIterCycles[speed], &stopped);
     if (machine->IsHalted()) {
       halt();
     } else if (stopped) {
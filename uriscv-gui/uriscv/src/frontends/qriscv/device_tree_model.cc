@@ -26,6 +26,7 @@
 
 #include "uriscv/device.h"
 #include "uriscv/machine.h"
+#include "uriscv/systembus.h"
 
 const char *const DeviceTreeModel::headerNames[N_COLUMNS] = {
     "Device", "HW Failure", "Status", "Completion Time"};
@@ -196,7 +197,8 @@ bool DeviceTreeModel::setData(const QModelIndex &index, const QVariant &value,
   Device *device = static_cast<Device *>(index.internalPointer());
   if (device && index.column() == COLUMN_DEVICE_CONDITION &&
       role == Qt::EditRole && value.canConvert<bool>()) {
-    device->setCondition(!value.toBool());
+    machine->getBus()->setDeviceCondition(device->getInterruptLine(),
+                                          device->getNumber(), !value.toBool());
     return true;
   }
 
@@ -31,6 +31,7 @@
 #include "base/lang.h"
 #include "qriscv/application.h"
 #include "uriscv/device.h"
+#include "uriscv/systembus.h"
 
 TerminalView::TerminalView(TerminalDevice *terminal, QWidget *parent)
     : QPlainTextEdit(parent), terminal(terminal) {
@@ -93,7 +94,8 @@ void TerminalView::insertFromMimeData(const QMimeData *source) {
 }
 
 void TerminalView::flushInput() {
-  terminal->Input(input.constData());
+  debugSession->getMachine()->getBus()->TerminalInput(terminal->getNumber(),
+                                                      input.constData());
   input.clear();
 }
 
@@ -35,6 +35,7 @@
 #include "qriscv/terminal_view.h"
 #include "qriscv/terminal_window_priv.h"
 #include "uriscv/device.h"
+#include "uriscv/systembus.h"
 #include "uriscv/types.h"
 
 TerminalWindow::TerminalWindow(unsigned int devNo, QWidget *parent)
@@ -169,7 +170,8 @@ void TerminalStatusWidget::onConditionChanged(bool isWorking) {
 }
 
 void TerminalStatusWidget::onHardwareFailureButtonClicked(bool checked) {
-  terminal->setCondition(!checked);
+  debugSession->getMachine()->getBus()->setDeviceCondition(
+      terminal->getInterruptLine(), terminal->getNumber(), !checked);
 }
 
 void TerminalStatusWidget::onExpanderButtonClicked() {
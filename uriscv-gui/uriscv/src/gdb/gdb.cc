@@ -6,28 +6,43 @@
  */
 
 #include "gdb/gdb.h"
+#include "base/lang.h"
 #include "uriscv/arch.h"
 #include "uriscv/const.h"
 #include "uriscv/machine.h"
 #include "uriscv/processor.h"
+#include "uriscv/systembus.h"
 #include "uriscv/utility.h"
+#include <algorithm>
 #include <arpa/inet.h>
+#include <cctype>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <poll.h>
 #include <signal.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <vector>
 #define PORT 8080
 
 #define emptyReply "$#00"
 
 const std::string OKReply = GDBServer::EncodeReply("OK");
+const std::string errorReply = GDBServer::EncodeReply("E01");
 
-#define qSupportedMsg                                                          \
-  "qSupported:multiprocess+;swbreak+;hwbreak+;qRelocInsn+;fork-events+;vfork-" \
-  "events+;exec-events+;vContSupported+;QThreadEvents+;no-resumed+;memory-"    \
-  "tagging+"
-const std::string qSupportedReply = GDBServer::EncodeReply("swbreak+;");
+#define qSupportedMsg "qSupported"
+
+HIDDEN std::string supportedReply() {
+  char r[64];
+  snprintf(r, sizeof(r), "PacketSize=%zx;swbreak+;binary-upload+",
+           GDBServer::kPacketSize);
+  return GDBServer::EncodeReply(r);
+}
+const std::string qSupportedReply = supportedReply();
 
 #define vMustReplyMsg "vMustReplyEmpty"
 
@@ -38,59 +53,124 @@ const std::string qAttachedReply = GDBServer::EncodeReply("1");
 
 #define vContMsg "vCont?"
 
+// Clock ticks run by each Step(): the machine stops at breakpoints by
+// itself, so this only bounds the latency of interrupts and of
+// breakpoint changes
+const uint32_t kStepsPerRun = 100000;
+
 pthread_mutex_t continue_mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t continue_cond = PTHREAD_COND_INITIALIZER;
-
-pthread_mutex_t stopped_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t bp_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-GDBServer::GDBServer(Machine *mac) {
+// Set by 'c' until the machine thread picks it up, so that continues
+// arriving while it is not waiting yet are not lost
+bool continue_requested = false;
+
+GDBServer::GDBServer(Machine *mac, StoppointSet *machineBreakpoints,
+                     StoppointSet *machineWatchpoints)
+    : breakpoints(std::make_shared<BreakpointSet>()),
+      machineBreakpoints(machineBreakpoints),
+      watchpoints(std::make_shared<WatchpointSet>()),
+      machineWatchpoints(machineWatchpoints) {
   this->killed = false;
   this->stopped = false;
+  this->interruptRequested = false;
   this->mac = mac;
-}
+  this->wakeupFd = -1;
 
-inline std::string GDBServer::getMsg(const std::string &msg) {
-  static std::regex reg(R"(.*\$(.*)#.*)");
-  std::smatch matches;
-  regex_match(msg, matches, reg);
-  if (matches.size() <= 1)
-    return "";
-
-  return matches[1].str();
+  machineWatchpoints->SignalHit.connect(
+      sigc::mem_fun(this, &GDBServer::onWatchpointHit));
+  mac->setStopMask(SC_BREAKPOINT | SC_SUSPECT);
 }
 
-std::string GDBServer::sendMemory(std::string &msg) {
-  /* deletes 'm' */
-  msg.erase(0, 1);
-
-  std::string delimiter = ",";
-  uint addr;
-  uint size;
-  std::stringstream sa, ss;
+// This function parses the "addr,length" memory packets start with,
+// and returns the position right after it through end
+HIDDEN bool parseMemoryArgs(const std::string &args, Word *addr, size_t *len,
+                            size_t *end) {
+  const char *s = args.c_str();
+  char *p;
+
+  const unsigned long a = strtoul(s, &p, 16);
+  if (p == s || *p != ',')
+    return false;
+  const char *l = p + 1;
+  const unsigned long n = strtoul(l, &p, 16);
+  if (p == l || a > MAXWORDVAL)
+    return false;
+
+  *addr = a;
+  *len = n;
+  *end = p - s;
+  return true;
+}
 
-  uint pos = msg.find(delimiter);
-  sa << std::hex << msg.substr(0, pos);
-  sa >> addr;
-  msg.erase(0, pos + delimiter.length());
-  ss << std::hex << msg.substr(0, msg.find(delimiter));
-  ss >> size;
+// This method serves 'm' (hex) and 'x' (binary) memory reads; replies
+// may be short of the length asked for, but never empty unless
+// that is zero
+std::string GDBServer::readMemory(const std::string &args, bool binary) {
+  Word addr;
+  size_t len, end;
+  if (!parseMemoryArgs(args, &addr, &len, &end) || end != args.size())
+    return errorReply;
+
+  // Replies must fit in a packet, even if every byte is escaped
+  std::vector<uint8_t> buf(std::min(len, kPacketSize / 2 - 1));
+  const size_t n = mac->getBus()->DebugRead(addr, buf.data(), buf.size());
+  if (n == 0 && !buf.empty())
+    return errorReply;
+
+  static const char digits[] = "0123456789abcdef";
+  std::string res;
+  if (binary) {
+    res.reserve(2 * n + 1);
+    res += 'b';
+    for (size_t i = 0; i < n; i++) {
+      const char c = buf[i];
+      if (c == '#' || c == '$' || c == '}' || c == '*') {
+        res += '}';
+        res += c ^ 0x20;
+      } else {
+        res += c;
+      }
+    }
+  } else {
+    res.reserve(2 * n);
+    for (size_t i = 0; i < n; i++) {
+      res += digits[buf[i] >> 4];
+      res += digits[buf[i] & 0xf];
+    }
+  }
 
-  std::string res = "";
+  return EncodeReply(res);
+}
 
-  uint instr = 0;
-  for (uint i = 0; i < size; i += WORD_SIZE) {
-    if (!mac->getBus()->InstrReadGDB(addr + i, &instr, mac->getProcessor(0))) {
-      char r[1024] = {0};
-      snprintf(r, 1024, "%08x", htonl(instr));
-      res += r;
+// This method serves 'M' (hex) and 'X' (binary) memory writes
+std::string GDBServer::writeMemory(const std::string &args, bool binary) {
+  Word addr;
+  size_t len, end;
+  if (!parseMemoryArgs(args, &addr, &len, &end) || end == args.size() ||
+      args[end] != ':')
+    return errorReply;
+
+  const std::string data = args.substr(end + 1);
+  std::vector<uint8_t> buf(len);
+  if (binary) {
+    if (data.size() != len)
+      return errorReply;
+    std::copy(data.begin(), data.end(), buf.begin());
+  } else {
+    if (data.size() != 2 * len)
+      return errorReply;
+    for (size_t i = 0; i < len; i++) {
+      const std::string byte = data.substr(2 * i, 2);
+      char *p;
+      buf[i] = strtoul(byte.c_str(), &p, 16);
+      if (!isxdigit(byte[0]) || *p != '\0')
+        return errorReply;
     }
   }
 
-  if (res == "")
-    return emptyReply;
-
-  return EncodeReply(res);
+  if (mac->getBus()->DebugWrite(addr, buf.data(), len) != len)
+    return errorReply;
+  return OKReply;
 }
 
 std::string GDBServer::readRegisters() {
@@ -158,34 +238,202 @@ std::string GDBServer::writeRegisters(std::string &msg) {
   return OKReply;
 }
 
+// This method runs the machine for a while, and returns true if it
+// stopped at a breakpoint or halted
 bool GDBServer::Step() {
   bool stopped = false;
-  mac->step(&stopped);
-  return stopped;
+
+  // While all processors are idle nothing can hit a breakpoint: skip
+  // straight to the next event
+  uint32_t idle = mac->idleCycles();
+  if (idle > 0) {
+    mac->skip(idle);
+    return false;
+  }
+
+  mac->run(kStepsPerRun, &stopped);
+  return stopped || mac->IsHalted();
 }
-bool GDBServer::CheckBreakpoint() {
-  return checkBreakpoint(mac->getProcessor(0)->getPC());
+
+// This method runs the machine from a continue until it stops, either
+// by itself or because gdb interrupted it. It is the only place the
+// machine is touched from while running, so the breakpoint set gdb
+// last published is copied into the machine's here, in between runs
+void GDBServer::Continue() {
+  stopReply = questionMarkReply;
+  do {
+    std::shared_ptr<const BreakpointSet> current =
+        std::atomic_load(&breakpoints);
+    if (current != syncedBreakpoints) {
+      syncBreakpoints(*current);
+      syncedBreakpoints = current;
+    }
+    std::shared_ptr<const WatchpointSet> currentWatch =
+        std::atomic_load(&watchpoints);
+    if (currentWatch != syncedWatchpoints) {
+      syncWatchpoints(*currentWatch);
+      syncedWatchpoints = currentWatch;
+    }
+  } while (!interruptRequested.exchange(false) && !Step());
+
+  NotifyStop();
 }
-inline bool GDBServer::checkBreakpoint(const uint &addr) {
-  pthread_mutex_lock(&bp_mutex);
-  bool r = std::find(breakpoints.begin(), breakpoints.end(), addr) !=
-           breakpoints.end();
-  pthread_mutex_unlock(&bp_mutex);
-  return r;
+
+// This function removes the stoppoint set at addr for asid, if any.
+// Remove() (unlike Clear()) lets the machine notice physical stoppoints
+// going away (see Machine::updatePageMap())
+HIDDEN void removeStoppoint(StoppointSet *set, Word asid, Word addr) {
+  Stoppoint *sp = set->Find(asid, addr);
+  if (sp != NULL)
+    set->Remove(sp->getIndex());
 }
-inline void GDBServer::addBreakpoint(const uint &addr) {
-  pthread_mutex_lock(&bp_mutex);
-  if (std::find(breakpoints.begin(), breakpoints.end(), addr) ==
-      breakpoints.end()) {
-    breakpoints.push_back(addr);
+
+// gdb breakpoints are not tied to an address space: each one is a
+// single ANYASID machine stoppoint. gdb removes and reinserts all of
+// its breakpoints around every stop, so only the addresses that changed
+// since the last sync are touched
+void GDBServer::syncBreakpoints(const BreakpointSet &set) {
+  if (syncedBreakpoints) {
+    for (Word addr : *syncedBreakpoints)
+      if (set.count(addr) == 0)
+        removeStoppoint(machineBreakpoints, ANYASID, addr);
+  }
+  for (Word addr : set)
+    if (!syncedBreakpoints || syncedBreakpoints->count(addr) == 0)
+      machineBreakpoints->Add(AddressRange(ANYASID, addr, addr), AM_EXEC);
+}
+
+// Like breakpoints, watchpoints are single ANYASID stoppoints. Kernel
+// ones are set for the physical address space (MAXASID) too, so that
+// devices writing there by DMA are caught. This function returns the
+// address spaces a watchpoint at addr is set for
+HIDDEN std::vector<Word> watchpointASIDs(Word addr) {
+  if (addr < KUSEGBASE)
+    return {ANYASID, MAXASID};
+  return {ANYASID};
+}
+
+// As for breakpoints, only the watchpoints that changed since the last
+// sync are touched; one whose mode changed is removed and set again
+void GDBServer::syncWatchpoints(const WatchpointSet &set) {
+  if (syncedWatchpoints) {
+    for (const WatchpointSet::value_type &w : *syncedWatchpoints) {
+      WatchpointSet::const_iterator it = set.find(w.first);
+      if (it == set.end() || !(it->second == w.second))
+        for (Word asid : watchpointASIDs(w.first))
+          removeStoppoint(machineWatchpoints, asid, w.first);
+    }
+  }
+  for (const WatchpointSet::value_type &w : set) {
+    if (syncedWatchpoints) {
+      WatchpointSet::const_iterator it = syncedWatchpoints->find(w.first);
+      if (it != syncedWatchpoints->end() && it->second == w.second)
+        continue;
+    }
+    const Word start = w.first, end = w.first + w.second.len - 1;
+    const AccessMode mode = (AccessMode)w.second.mode;
+    for (Word asid : watchpointASIDs(w.first))
+      machineWatchpoints->Add(AddressRange(asid, start, end), mode);
   }
-  pthread_mutex_unlock(&bp_mutex);
+}
+
+// This method is called by the machine thread when a watched range is
+// accessed: the machine stops at the end of the cycle, and the stop
+// reply tells gdb what was hit
+void GDBServer::onWatchpointHit(size_t index, const Stoppoint *sp, Word addr,
+                                const Processor *cpu) {
+  UNUSED_ARG(index);
+  UNUSED_ARG(cpu);
+
+  const char *kind = "awatch";
+  if (sp->getAccessMode() == AM_WRITE)
+    kind = "watch";
+  else if (sp->getAccessMode() == AM_READ)
+    kind = "rwatch";
+
+  char r[64];
+  snprintf(r, sizeof(r), "T05%s:%x;", kind, addr);
+  stopReply = EncodeReply(r);
+}
+
+HIDDEN unsigned int watchpointMode(char type) {
+  switch (type) {
+  case '2':
+    return AM_WRITE;
+  case '3':
+    return AM_READ;
+  default:
+    return AM_READ_WRITE;
+  }
+}
+
+// This method serves Z2 (write), Z3 (read) and Z4 (access) packets.
+// gdb may watch the same range for different kinds of access, which
+// are then merged into a single watchpoint
+std::string GDBServer::insertWatchpoint(const std::string &msg) {
+  Word addr;
+  size_t len, end;
+  if (msg.size() < 3 || msg[2] != ',' ||
+      !parseMemoryArgs(msg.substr(3), &addr, &len, &end) || len == 0 ||
+      addr + (len - 1) < addr)
+    return errorReply;
+
+  std::shared_ptr<WatchpointSet> set =
+      std::make_shared<WatchpointSet>(*watchpoints);
+  WatchpointSet::iterator it = set->find(addr);
+  if (it != set->end() && it->second.len == len) {
+    it->second.mode |= watchpointMode(msg[1]);
+  } else {
+    // Machine stoppoints must not overlap
+    it = set->lower_bound(addr);
+    if (it != set->end() && it->first <= addr + (len - 1))
+      return errorReply;
+    if (it != set->begin() && addr <= (--it)->first + (it->second.len - 1))
+      return errorReply;
+
+    Watchpoint w;
+    w.len = len;
+    w.mode = watchpointMode(msg[1]);
+    (*set)[addr] = w;
+  }
+
+  std::atomic_store(&watchpoints, std::shared_ptr<const WatchpointSet>(set));
+  return OKReply;
+}
+
+std::string GDBServer::removeWatchpoint(const std::string &msg) {
+  Word addr;
+  size_t len, end;
+  if (msg.size() < 3 || msg[2] != ',' ||
+      !parseMemoryArgs(msg.substr(3), &addr, &len, &end))
+    return errorReply;
+
+  std::shared_ptr<WatchpointSet> set =
+      std::make_shared<WatchpointSet>(*watchpoints);
+  WatchpointSet::iterator it = set->find(addr);
+  if (it == set->end() || it->second.len != len)
+    return errorReply;
+  if ((it->second.mode &= ~watchpointMode(msg[1])) == 0)
+    set->erase(it);
+
+  std::atomic_store(&watchpoints, std::shared_ptr<const WatchpointSet>(set));
+  return OKReply;
+}
+
+// Breakpoint sets are never changed once published: this method swaps
+// in a new one instead, which the machine thread picks up without any
+// locking
+inline void GDBServer::addBreakpoint(const uint &addr) {
+  std::shared_ptr<BreakpointSet> set =
+      std::make_shared<BreakpointSet>(*breakpoints);
+  set->insert(addr);
+  std::atomic_store(&breakpoints, std::shared_ptr<const BreakpointSet>(set));
 }
 inline void GDBServer::removeBreakpoint(const uint &addr) {
-  pthread_mutex_lock(&bp_mutex);
-  auto new_end = remove(breakpoints.begin(), breakpoints.end(), addr);
-  (void)new_end;
-  pthread_mutex_unlock(&bp_mutex);
+  std::shared_ptr<BreakpointSet> set =
+      std::make_shared<BreakpointSet>(*breakpoints);
+  set->erase(addr);
+  std::atomic_store(&breakpoints, std::shared_ptr<const BreakpointSet>(set));
 }
 
 uint GDBServer::parseBreakpoint(std::string &msg) {
@@ -202,18 +450,11 @@ uint GDBServer::parseBreakpoint(std::string &msg) {
 }
 
 std::string GDBServer::ReadData(const std::string &msg) {
-  if (msg.c_str()[0] == 0x3) {
-    pthread_mutex_lock(&stopped_mutex);
-    stopped = true;
-    pthread_mutex_unlock(&stopped_mutex);
-    return OKReply;
-  }
-
-  std::string body = getMsg(msg);
+  std::string body = msg;
   if (body == "")
     return emptyReply;
 
-  if (strcmp(body.c_str(), qSupportedMsg) == 0) {
+  if (body.compare(0, strlen(qSupportedMsg), qSupportedMsg) == 0) {
     return qSupportedReply;
   } else if (strcmp(body.c_str(), qAttachedMsg) == 0) {
     return qAttachedReply;
@@ -224,7 +465,13 @@ std::string GDBServer::ReadData(const std::string &msg) {
   } else if (strcmp(body.c_str(), "g") == 0) {
     return readRegisters();
   } else if (body.c_str()[0] == 'm') {
-    return sendMemory(body);
+    return readMemory(body.substr(1), false);
+  } else if (body.c_str()[0] == 'x') {
+    return readMemory(body.substr(1), true);
+  } else if (body.c_str()[0] == 'M') {
+    return writeMemory(body.substr(1), false);
+  } else if (body.c_str()[0] == 'X') {
+    return writeMemory(body.substr(1), true);
   } else if (body.c_str()[0] == 'k') {
     killed = true;
     return OKReply;
@@ -235,13 +482,20 @@ std::string GDBServer::ReadData(const std::string &msg) {
     writeRegisters(body);
     return OKReply;
   } else if (body.c_str()[0] == 'c') {
+    interruptRequested = false;
 
     pthread_mutex_lock(&continue_mutex);
+    continue_requested = true;
     pthread_cond_signal(&continue_cond);
     pthread_mutex_unlock(&continue_mutex);
 
-    // return qAttachedReply;
-    return OKReply;
+    // The stop reply is sent when the machine stops (see NotifyStop())
+    return "";
+  } else if ((body.c_str()[0] == 'z' || body.c_str()[0] == 'Z') &&
+             body.c_str()[1] >= '2' && body.c_str()[1] <= '4') {
+    if (body.c_str()[0] == 'Z')
+      return insertWatchpoint(body);
+    return removeWatchpoint(body);
   } else if (body.c_str()[0] == 'z') {
     uint addr = parseBreakpoint(body);
     removeBreakpoint(addr);
@@ -265,44 +519,162 @@ void *MachineStep(void *vargp) {
   while (true) {
 
     pthread_mutex_lock(&continue_mutex);
-    pthread_cond_wait(&continue_cond, &continue_mutex);
+    while (!continue_requested)
+      pthread_cond_wait(&continue_cond, &continue_mutex);
+    continue_requested = false;
     pthread_mutex_unlock(&continue_mutex);
 
-    bool s = false;
-    do {
-      gdb->Step();
+    gdb->Continue();
+  }
+
+  pthread_exit((void *)0);
+}
+
+void GDBServer::NotifyStop() {
+  stopped = true;
 
-      pthread_mutex_lock(&stopped_mutex);
-      s = gdb->IsStopped();
-      pthread_mutex_unlock(&stopped_mutex);
-    } while (!gdb->CheckBreakpoint() && !s);
+  const uint64_t one = 1;
+  if (write(wakeupFd, &one, sizeof(one)) < 0)
+    perror("eventfd write");
+}
 
-    if (!s) {
-      pthread_mutex_lock(&stopped_mutex);
-      gdb->Stop();
-      pthread_mutex_unlock(&stopped_mutex);
+void GDBServer::sendMsg(const std::string &msg) {
+  DEBUGMSG("[GDB][<-] %s\n\n", msg.c_str());
+  outBuf += msg;
+  if (msg[0] == '$')
+    lastReply = msg;
+}
+
+// This method frames the packets received so far: each complete one
+// is acknowledged and handled, or NAKed if its checksum does not
+// match, while incomplete ones are left in inBuf until the rest comes
+void GDBServer::processInput() {
+  size_t pos = 0;
+  while (pos < inBuf.size()) {
+    const char c = inBuf[pos];
+
+    if (c == '$') {
+      const size_t hash = inBuf.find('#', pos + 1);
+      if (hash == std::string::npos || hash + 2 >= inBuf.size())
+        break;
+
+      std::string body = inBuf.substr(pos + 1, hash - pos - 1);
+      const std::string sum = inBuf.substr(hash + 1, 2);
+      pos = hash + 3;
+
+      char *end;
+      if (!isxdigit(sum[0]) ||
+          strtoul(sum.c_str(), &end, 16) != Checksum(body) || *end != '\0') {
+        DEBUGMSG("[GDB] Bad checksum: %s\n", body.c_str());
+        sendMsg("-");
+        continue;
+      }
+      sendMsg("+");
+
+      // Binary data is escaped as '}' followed by the byte xor 0x20
+      std::string::iterator out = body.begin();
+      for (std::string::const_iterator in = body.begin(); in != body.end();
+           ++in)
+        *out++ = (*in == '}' && in + 1 != body.end()) ? *++in ^ 0x20 : *in;
+      body.erase(out, body.end());
+
+      DEBUGMSG("[GDB][->] %s\n", body.c_str());
+      const std::string reply = ReadData(body);
+      if (!reply.empty())
+        sendMsg(reply);
+    } else {
+      if (c == 0x03) {
+        // Interrupt: the machine thread sends the stop reply
+        interruptRequested = true;
+      } else if (c == '-' && !lastReply.empty()) {
+        outBuf += lastReply;
+      }
+      // '+' acknowledges our last packet; anything else is line noise
+      pos++;
     }
   }
+  inBuf.erase(0, pos);
+}
 
-  pthread_exit((void *)0);
+// This method sends as much of outBuf as the socket takes without
+// blocking, and returns false if the connection is broken
+bool GDBServer::flushOutput(int socket) {
+  while (!outBuf.empty()) {
+    ssize_t n = send(socket, outBuf.data(), outBuf.size(), MSG_NOSIGNAL);
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    outBuf.erase(0, n);
+  }
+  return true;
 }
 
-void GDBServer::sendMsg(const int &socket, const std::string &msg) {
-  /* + is the ACK */
-  std::string reply = "+" + msg;
-  DEBUGMSG("[GDB][<-] %s\n\n", reply.c_str());
+// This method serves a gdb connection until gdb kills the target or
+// goes away. Everything happens in response to either the socket or
+// the machine thread (through wakeupFd) becoming ready, so replies
+// go out as soon as they are available
+void GDBServer::serveConnection(int socket) {
+  fcntl(socket, F_SETFL, fcntl(socket, F_GETFL) | O_NONBLOCK);
+  int nodelay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+  inBuf.clear();
+  outBuf.clear();
+  lastReply.clear();
+
+  struct pollfd fds[2];
+  fds[0].fd = socket;
+  fds[1].fd = wakeupFd;
+  fds[1].events = POLLIN;
+
+  while (!killed) {
+    fds[0].events = POLLIN | (outBuf.empty() ? 0 : POLLOUT);
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("poll");
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      uint64_t count;
+      if (read(wakeupFd, &count, sizeof(count)) < 0)
+        perror("eventfd read");
+      if (stopped.exchange(false))
+        sendMsg(stopReply);
+    }
+
+    if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      char buffer[kPacketSize];
+      ssize_t n = read(socket, buffer, sizeof(buffer));
+      if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        DEBUGMSG("[GDB] Connection closed\n");
+        break;
+      }
+      if (n > 0) {
+        inBuf.append(buffer, n);
+        processInput();
+      }
+    }
 
-  send(socket, reply.c_str(), (reply).size(), 0);
+    if (!flushOutput(socket)) {
+      DEBUGMSG("[GDB] Connection broken\n");
+      break;
+    }
+  }
 }
 
 void GDBServer::StartServer() {
   DEBUGMSG("[GDB] Starting GDB Server\n");
 
-  int server_fd, new_socket, valread;
+  int server_fd, new_socket;
   struct sockaddr_in address;
   int opt = 1;
   int addrlen = sizeof(address);
-  char buffer[1024] = {0};
+
+  if ((wakeupFd = eventfd(0, EFD_NONBLOCK)) < 0) {
+    perror("eventfd");
+    exit(EXIT_FAILURE);
+  }
 
   // Creating socket file descriptor
   if ((server_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
@@ -345,35 +717,7 @@ void GDBServer::StartServer() {
 
     DEBUGMSG("[GDB] GDB connection accepted\n");
 
-    struct pollfd fds[1];
-    int timeout = 100;
-    fds[0].fd = new_socket;
-    fds[0].events = POLLIN;
-
-    while (!killed) {
-
-      /* clean the buffer */
-      valread = poll(fds, 1, timeout);
-      if (valread > 0 && (read(new_socket, buffer, 1024)) != 0) {
-
-        if (strcmp(buffer, "+") != 0 && strcmp(buffer, "") != 0) {
-          DEBUGMSG("[GDB][->] %s (%x)\n", buffer, buffer[0]);
-
-          std::string d = ReadData(buffer);
-          sendMsg(new_socket, d);
-        }
-      }
-      usleep(200);
-      memset(buffer, 0, 1024);
-
-      pthread_mutex_lock(&stopped_mutex);
-      if (stopped) {
-        stopped = false;
-        pthread_mutex_unlock(&stopped_mutex);
-        sendMsg(new_socket, questionMarkReply);
-      } else
-        pthread_mutex_unlock(&stopped_mutex);
-    }
+    serveConnection(new_socket);
 
     DEBUGMSG("[GDB] GDB Session terminated\n");
 
@@ -1,62 +1,118 @@
 #include "uriscv/machine.h"
+#include "uriscv/stoppoint.h"
+#include <atomic>
 #include <cstring>
+#include <map>
+#include <memory>
 #include <netinet/in.h>
-#include <regex>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <unordered_set>
 #include <vector>
 
 class GDBServer {
 public:
-  GDBServer(Machine *mac);
+  // Breakpoints and watchpoints are set in machineBreakpoints and
+  // machineWatchpoints, the breakpoint and suspect sets mac was created
+  // with, which the server takes over
+  GDBServer(Machine *mac, StoppointSet *machineBreakpoints,
+            StoppointSet *machineWatchpoints);
   void StartServer();
 
-  static std::string GetChecksum(const std::string &msg) {
+  // Largest packet gdb may send us (see qSupported)
+  static const size_t kPacketSize = 0x4000;
+
+  static uint Checksum(const std::string &msg) {
     uint checksum = 0;
     for (const char &c : msg) {
-      checksum += static_cast<uint>(c);
+      checksum += static_cast<unsigned char>(c);
     }
-    checksum &= 0xff;
-    char buffer[4];
-    snprintf(buffer, 3, "%02x", checksum);
-    return buffer;
+    return checksum & 0xff;
   }
 
-  static inline std::string EncodeReply(const std::string msg) {
-    const int len = msg.length() + 4 + 1;
-    char buffer[1024];
-    snprintf(buffer, len, "$%s#%s", msg.c_str(), (GetChecksum(msg)).c_str());
+  static std::string GetChecksum(const std::string &msg) {
+    char buffer[3];
+    snprintf(buffer, sizeof(buffer), "%02x", Checksum(msg));
     return buffer;
   }
 
-  std::string ReadData(const std::string &msg);
-  bool CheckBreakpoint();
+  static inline std::string EncodeReply(const std::string &msg) {
+    return "$" + msg + "#" + GetChecksum(msg);
+  }
+
+  // This method handles the body of a packet, and returns the reply to
+  // send back, if any
+  std::string ReadData(const std::string &body);
   bool Step();
+  void Continue();
 
-  inline void Stop() { stopped = true; };
-  bool IsStopped() const { return stopped; };
+  // This method is called by the machine thread when it stops, to get
+  // the stop reply sent
+  void NotifyStop();
 
 private:
-  bool killed, stopped;
+  typedef std::unordered_set<Word> BreakpointSet;
+
+  // Watchpoints, by start address; all of them are watched in every
+  // address space, kernel ones for DMA too
+  struct Watchpoint {
+    Word len;
+    unsigned int mode;
+
+    bool operator==(const Watchpoint &w) const {
+      return len == w.len && mode == w.mode;
+    }
+  };
+  typedef std::map<Word, Watchpoint> WatchpointSet;
+
+  bool killed;
+  std::atomic<bool> stopped, interruptRequested;
   Machine *mac;
-  std::vector<uint> breakpoints;
+
+  // breakpoint addresses as last published by the server thread, and
+  // as last copied into the machine by the machine thread
+  std::shared_ptr<const BreakpointSet> breakpoints;
+  std::shared_ptr<const BreakpointSet> syncedBreakpoints;
+  StoppointSet *const machineBreakpoints;
+
+  // the same for watchpoints, and the reply to send for the last stop
+  std::shared_ptr<const WatchpointSet> watchpoints;
+  std::shared_ptr<const WatchpointSet> syncedWatchpoints;
+  StoppointSet *const machineWatchpoints;
+  std::string stopReply;
+
+  // connection state: bytes received and not yet framed, bytes still
+  // to be sent, and the last packet sent (resent on a NAK)
+  int wakeupFd;
+  std::string inBuf;
+  std::string outBuf;
+  std::string lastReply;
 
   std::string readRegisters();
   std::string writeRegister(std::string &msg);
   std::string writeRegisters(std::string &msg);
-  std::string sendMemory(std::string &msg);
-  static inline std::string getMsg(const std::string &msg);
+  std::string readMemory(const std::string &args, bool binary);
+  std::string writeMemory(const std::string &args, bool binary);
 
   uint parseBreakpoint(std::string &msg);
 
-  inline bool checkBreakpoint(const uint &addr);
+  void syncBreakpoints(const BreakpointSet &set);
   inline void addBreakpoint(const uint &addr);
   inline void removeBreakpoint(const uint &addr);
 
-  void sendMsg(const int &socket, const std::string &msg);
+  void syncWatchpoints(const WatchpointSet &set);
+  std::string insertWatchpoint(const std::string &msg);
+  std::string removeWatchpoint(const std::string &msg);
+  void onWatchpointHit(size_t index, const Stoppoint *sp, Word addr,
+                       const Processor *cpu);
+
+  void serveConnection(int socket);
+  void processInput();
+  bool flushOutput(int socket);
+  void sendMsg(const std::string &msg);
 };
 
 typedef struct thread_arg_struct {
@@ -53,6 +53,10 @@ public:
 
   const QString &getCurrentDir() const { return dir; }
 
+  // File the inputs to each machine are recorded to, if any (see
+  // SystemBus::RecordInputs())
+  const QString &getInputLogFile() const { return inputLogFile; }
+
   QFont getMonospaceFont();
   QFont getBoldFont();
 
@@ -71,6 +75,8 @@ private:
   scoped_ptr<MachineConfig> config;
   QString dir;
 
+  QString inputLogFile;
+
   scoped_ptr<MonitorWindow> monitorWindow;
 };
 
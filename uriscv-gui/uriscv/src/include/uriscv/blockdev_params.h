@@ -33,6 +33,7 @@
 #define BIOSFILEID 0x02534952
 #define COREFILEID 0x03534952
 #define AOUTFILEID 0x04534952
+#define SNAPFILEID 0x05534952
 #define STABFILEID 0x41534952
 
 // DiskParams class items constants: position, min, max and default (DFL)
@@ -86,6 +86,10 @@
 /* number of ASIDs */
 #define MAXASID 64
 
+/* ASID of stoppoints covering all the virtual address spaces (but not
+ the physical one, MAXASID) */
+#define ANYASID (MAXASID + 1)
+
 /* MIPS NOP instruction */
 #define NOP 0x00000013
 
@@ -0,0 +1,126 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef URISCV_DECODE_CACHE_H
+#define URISCV_DECODE_CACHE_H
+
+#include <cstddef>
+
+#include "base/lang.h"
+#include "uriscv/types.h"
+
+class Processor;
+
+// A DecodedInstr holds an instruction word with its operand fields
+// already extracted (and its immediate already sign-extended), together
+// with the Processor method that executes it. A NULL handler marks a
+// slot that has not been decoded yet.
+
+struct DecodedInstr {
+  typedef bool (Processor::*Handler)(const DecodedInstr *);
+
+  // Instruction classes, as seen by Processor::ExecBlock()
+  enum Flags {
+    DI_LOAD = 1 << 0,  // reads memory through the bus
+    DI_STORE = 1 << 1, // writes memory through the bus
+    DI_SYSTEM = 1 << 2, // must be executed by Processor::Cycle()
+    DI_BRANCH = 1 << 3  // may transfer control
+  };
+
+  Handler handler;
+  Word instr;
+  SWord imm;
+  uint8_t rd;
+  uint8_t rs1;
+  uint8_t rs2;
+  uint8_t flags;
+};
+
+// This class implements a cache of decoded instructions, indexed by
+// physical address. The cache is organized in pages (one slot for each
+// word) which are allocated the first time code is executed from them;
+// SystemBus must call Invalidate() on every write to memory, so that
+// stale slots are decoded again before being executed. Each processor
+// has its own cache; the pages they hold are recorded in a bitmap
+// shared by all of them, so that SystemBus can tell code pages apart.
+
+class DecodeCache {
+public:
+  // This method creates a new (empty) cache, which marks the pages it
+  // allocates in codePages (one bit for each physical page)
+  DecodeCache(uint32_t *codePages);
+  ~DecodeCache();
+
+  // This method returns the slot for the instruction at physical
+  // address paddr, allocating its page if needed
+  DecodedInstr *Lookup(Word paddr);
+
+  // This method marks the slot for the word at physical address paddr
+  // as not decoded, if its page is cached
+  void Invalidate(Word paddr);
+
+  // This method discards all the decoded instructions
+  void Flush();
+
+private:
+  static const unsigned int kPageShift = 12;
+  static const unsigned int kPageSlots = 1U << (kPageShift - 2);
+  static const unsigned int kTableShift = 22;
+  static const unsigned int kTableSize = 1U << (kTableShift - kPageShift);
+  static const unsigned int kDirSize = 1U << (32 - kTableShift);
+
+  struct Page {
+    DecodedInstr slot[kPageSlots];
+  };
+
+  Page *getPage(Word pfn);
+
+  // Two-level page directory: the high bits of a physical address
+  // select a table, the middle ones a page
+  Page **dir[kDirSize];
+
+  uint32_t *const codePages;
+
+  // Last page returned by Lookup(), since consecutive fetches almost
+  // always hit the same page
+  Word lastPfn;
+  Page *lastPage;
+
+  DISABLE_COPY_AND_ASSIGNMENT(DecodeCache);
+};
+
+inline DecodedInstr *DecodeCache::Lookup(Word paddr) {
+  Word pfn = paddr >> kPageShift;
+  if (lastPage == NULL || pfn != lastPfn) {
+    lastPage = getPage(pfn);
+    lastPfn = pfn;
+  }
+  return &lastPage->slot[(paddr >> 2) & (kPageSlots - 1)];
+}
+
+inline void DecodeCache::Invalidate(Word paddr) {
+  Page **table = dir[paddr >> kTableShift];
+  if (table != NULL) {
+    Page *page = table[(paddr >> kPageShift) & (kTableSize - 1)];
+    if (page != NULL)
+      page->slot[(paddr >> 2) & (kPageSlots - 1)].handler = NULL;
+  }
+}
+
+#endif // URISCV_DECODE_CACHE_H
@@ -51,6 +51,8 @@ class DiskParams;
 class FlashParams;
 class netinterface;
 class MachineConfig;
+class SnapshotWriter;
+class SnapshotReader;
 
 // Device class defines the interface to all device types, and represents
 // the "uninstalled device" (NULLDEV) itself. Device objects are created and
@@ -99,6 +101,12 @@ public:
   // devices (NULLDEV included) and produces a panic message
   virtual void Input(const char *inputstr);
 
+  // This method switches the device to the host file fileName: log
+  // devices start a new log, block devices reopen their image (which
+  // must have the same format as the one given in the configuration);
+  // not operational for other devices, and produces a panic message
+  virtual void setFile(const std::string &fileName);
+
   // This method returns the current value for device register field
   // indexed by regnum
   Word ReadDevReg(unsigned int regnum);
@@ -117,6 +125,13 @@ public:
   void setCondition(bool working);
   bool getCondition() const { return isWorking; }
 
+  // These methods save the device state (registers, pending operation
+  // and buffers) to a snapshot and restore it; the host files backing
+  // the device are not saved, and block device images must not be
+  // changed in between
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
+
   sigc::signal<void, const char *> SignalStatusChanged;
   sigc::signal<void, bool> SignalConditionChanged;
 
@@ -163,6 +178,9 @@ public:
   virtual void WriteDevReg(unsigned int regnum, Word data);
   virtual unsigned int CompleteDevOp();
   virtual const char *getDevSStr();
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
+  virtual void setFile(const std::string &fileName);
 
 private:
   const MachineConfig *const config;
@@ -205,6 +223,10 @@ public:
 
   virtual void Input(const char *inputstr);
 
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
+  virtual void setFile(const std::string &fileName);
+
   sigc::signal<void, char> SignalTransmitted;
 
 private:
@@ -266,6 +288,9 @@ public:
   virtual void WriteDevReg(unsigned int regnum, Word data);
   virtual unsigned int CompleteDevOp();
   virtual const char *getDevSStr();
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
+  virtual void setFile(const std::string &fileName);
 
 private:
   const MachineConfig *const config;
@@ -318,6 +343,9 @@ public:
   virtual void WriteDevReg(unsigned int regnum, Word data);
   virtual unsigned int CompleteDevOp();
   virtual const char *getDevSStr();
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
+  virtual void setFile(const std::string &fileName);
 
 private:
   const MachineConfig *const config;
@@ -351,6 +379,8 @@ public:
   virtual void WriteDevReg(unsigned int regnum, Word data);
   virtual unsigned int CompleteDevOp();
   virtual const char *getDevSStr();
+  virtual void Save(SnapshotWriter &out) const;
+  virtual void Restore(SnapshotReader &in);
 
 protected:
   virtual bool isBusy() const;
@@ -22,51 +22,82 @@
 #ifndef URISCV_EVENT_H
 #define URISCV_EVENT_H
 
+#include <vector>
+
 #include <boost/function.hpp>
 
+#include "base/lang.h"
 #include "uriscv/types.h"
 
+class SnapshotWriter;
+class SnapshotReader;
+
+// EventTag describes what an event does (which device operation it
+// completes, which processor it resets, ...) in a form that can be
+// saved to a snapshot; SystemBus turns tags into callbacks, both when
+// events are scheduled and when they are restored.
+
+struct EventTag {
+  enum Type {
+    ET_DEVICE_OP, // args: interrupt line, device number
+    ET_CPU_RESET, // args: cpu id, boot PC, boot SP
+    ET_CPU_HALT,  // args: cpu id
+    ET_POWEROFF,
+    ET_IPI // args: origin cpu id, outbox value
+  };
+
+  EventTag(unsigned int type = ET_POWEROFF, Word arg0 = 0, Word arg1 = 0,
+           Word arg2 = 0)
+      : type(type) {
+    arg[0] = arg0;
+    arg[1] = arg1;
+    arg[2] = arg2;
+  }
+
+  unsigned int type;
+  Word arg[3];
+};
+
 // Event class is used to keep track of the external events of the
 // system: device operations and interrupt generation.
-// Every object contains a device number saying what device will complete
-// its operation and generate a interrupt, a TimeStamp saying when it
-// will happen, and a pointer to the next event in a structure, if needed
-// (set to NULL otherwise)
+// Every object contains the callback to run, the tag it was built from,
+// and the time it has to be run at. Events are owned by an EventQueue,
+// which recycles them once they have happened.
 
 class Event {
 public:
   typedef boost::function<void()> Callback;
 
-  Event(uint64_t ts, Word inc, Callback callback);
-
   uint64_t getDeadline() const { return deadline; }
-  Callback getCallback() const { return callback; }
+  const EventTag &getTag() const { return tag; }
+  const Callback &getCallback() const { return callback; }
 
-  // This method links an Event to its successor in a structure
-  void AddBefore(Event *ev);
-
-  // This method inserts an Event after another, linking the former to the
-  // successor of the latter
-  void InsAfter(Event *ev);
+private:
+  friend class EventQueue;
 
-  // This method returns the pointer to the successor of an Event
-  Event *Next();
+  Event() : deadline(0), order(0), next(NULL) {}
 
-private:
-  // Event verification time
+  // Event verification time, and order among the events with the same
+  // one (lower first)
   uint64_t deadline;
+  int64_t order;
 
-  // Event handler
+  // Event handler, and its description
+  EventTag tag;
   Callback callback;
 
+  // Next free Event, while in the EventQueue pool
   Event *next;
 };
 
-// This class implements a NULL-terminated sorted queue of Event objects,
-// used to schedule the device events in the system.
-// An object contains a pointer to the head of the queue, and a pointer to
-// the last inserted Event (to speed up insertion).
-// The queue is sorted on ascending timestamp order
+// This class implements a time-ordered queue of Event objects, used to
+// schedule the device events in the system.
+// Events are kept in a binary min-heap; events with the same deadline
+// happen in the order a sorted list would give them (an event that is
+// due no later than all the queued ones goes first, any other one after
+// those due at the same time). Events are allocated in chunks and
+// recycled through a free list, so that scheduling does not allocate
+// memory in the steady state.
 
 class EventQueue {
 public:
@@ -76,25 +107,52 @@ public:
   ~EventQueue();
 
   // This method returns TRUE if the queue is empty, FALSE otherwise
-  bool IsEmpty() const { return head == NULL; }
+  bool IsEmpty() const { return heap.empty(); }
 
   uint64_t nextDeadline() const;
-  Event::Callback nextCallback() const;
 
-  // This method creates a new Event object and inserts it in the
-  // EventQueue; EventQueue is sorted on ascending time order
-  uint64_t InsertQ(uint64_t tod, Word delay, Event::Callback callback);
+  // This method inserts an Event happening at tod + delay in the
+  // EventQueue, and returns its deadline
+  uint64_t InsertQ(uint64_t tod, Word delay, const EventTag &tag,
+                   const Event::Callback &callback);
 
-  // This method removes the head of a (not empty) queue and sets it to the
-  // following Event
-  void RemoveHead();
+  // This method removes the head of a (not empty) queue and runs its
+  // callback, which may insert new events
+  void RunHead();
+
+  // These methods save the queued events (their deadlines, order and
+  // tags) to a snapshot, and replace the queue contents with the ones
+  // saved, rebuilding each callback from its tag with makeCallback
+  typedef boost::function<Event::Callback(const EventTag &)> CallbackMaker;
+  void Save(SnapshotWriter &out) const;
+  void Restore(SnapshotReader &in, const CallbackMaker &makeCallback);
 
 private:
-  // head of the queue
-  Event *head;
+  static const unsigned int kChunkSize = 32;
+
+  static bool before(const Event *a, const Event *b) {
+    return a->deadline < b->deadline ||
+           (a->deadline == b->deadline && a->order < b->order);
+  }
+
+  Event *allocEvent();
+  void freeEvent(Event *ev);
+
+  void siftUp(size_t i);
+  void siftDown(size_t i);
+
+  std::vector<Event *> heap;
+
+  // order given to the next event going first or last among the ones
+  // with the same deadline
+  int64_t firstOrder;
+  int64_t lastOrder;
+
+  // Events not in use, and the chunks all events were allocated in
+  Event *freeList;
+  std::vector<Event *> chunks;
 
-  // last Event inserted
-  Event *lastIns;
+  DISABLE_COPY_AND_ASSIGNMENT(EventQueue);
 };
 
 #endif // URISCV_EVENT_H
@@ -0,0 +1,83 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+#ifndef URISCV_INPUT_LOG_H
+#define URISCV_INPUT_LOG_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "base/lang.h"
+#include "uriscv/types.h"
+
+// ExternalInput describes an input the machine gets from outside the
+// simulation, and the clock tick it takes effect at.
+
+struct ExternalInput {
+  enum Type {
+    EI_TERMINAL, // characters typed at a terminal (text)
+    EI_CONDITION // device operational status change (working)
+  };
+
+  ExternalInput(unsigned int type = EI_TERMINAL, unsigned int il = 0,
+                unsigned int devNo = 0)
+      : tick(0), type(type), il(il), devNo(devNo), working(true) {}
+
+  uint64_t tick;
+  unsigned int type;
+  unsigned int il;
+  unsigned int devNo;
+  bool working;
+  std::string text;
+};
+
+// InputLog writes the inputs a machine gets to a text file as they
+// come, one per line, so that a later run can replay them (see
+// SystemBus::ReplayInputs()):
+//
+//   <tick> input <device> <text>
+//   <tick> condition <device> <0|1>
+//
+// where devices are named as in the machine configuration (e.g.
+// "terminal0"), and text has backslashes and non printable characters
+// escaped as \xHH. Lines starting with '#' are comments. Errors are
+// reported by throwing the exceptions in error.h.
+
+class InputLog {
+public:
+  // This method creates the log file fileName
+  explicit InputLog(const std::string &fileName);
+  ~InputLog();
+
+  // This method appends input to the log, and flushes it
+  void Write(const ExternalInput &input);
+
+  // This method reads all the inputs in log file fileName
+  static std::vector<ExternalInput> Read(const std::string &fileName);
+
+private:
+  const std::string fileName;
+  FILE *file;
+
+  DISABLE_COPY_AND_ASSIGNMENT(InputLog);
+};
+
+#endif // URISCV_INPUT_LOG_H
@@ -0,0 +1,179 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef URISCV_JIT_H
+#define URISCV_JIT_H
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "base/lang.h"
+#include "uriscv/types.h"
+
+class SystemBus;
+
+// State shared by translated code and the processor running it: on
+// entry budget holds the cycles the code may run and pc the address of
+// the first instruction; on return pc is the address execution stopped
+// at and lastPC the one of the last instruction executed. Data
+// addresses below readLimit (writeLimit for stores) are physical ones,
+// so that translated code may access them with no address translation.
+struct JitContext {
+  uint32_t budget;
+  Word pc;
+  Word lastPC;
+  Word readLimit;
+  Word writeLimit;
+};
+
+// Translated code is called with the processor general purpose
+// registers and the context
+typedef void (*JitCode)(SWord *gpr, JitContext *ctx);
+
+// This class implements a just-in-time compiler from guest basic blocks
+// to x86-64 host code. The integer computational instructions, loads,
+// stores, conditional branches, JAL and JALR are translated (a block
+// ends before any other instruction, which is left to the interpreter).
+// Translated code never raises exceptions: loads and stores only access
+// the pages SystemBus maps for direct access, and stop before the
+// instruction (leaving it to the interpreter) on any other page, on
+// misaligned words and on stores to pages code was decoded from.
+// Blocks are translated once they get hot, and are chained to each
+// other when control stays inside the same page (JALR through a cache
+// of recent blocks); all code is discarded when a page it was
+// translated from is written, and pages written too often (data sharing
+// a page with code) are not translated any more. The code buffer is
+// never writable and executable at the same time.
+
+class Jit {
+public:
+  Jit(SystemBus *bus);
+  ~Jit();
+
+  // This method tells whether translation is supported on this host
+  static bool IsSupported();
+
+  // This method returns the code for the block starting at virtual
+  // address vaddr (physical address paddr), translating it if it just
+  // got hot; NULL is returned if there is no code for it (yet)
+  JitCode Lookup(Word vaddr, Word paddr);
+
+  // This method tells whether code was translated from the page
+  // containing physical address paddr
+  bool HasCode(Word paddr) const;
+
+  // This method discards all the code translated from the page
+  // containing physical address paddr
+  void Invalidate(Word paddr);
+
+  // This method discards all the translated code
+  void Flush();
+
+private:
+  static const unsigned int kHotThreshold = 16;
+  static const unsigned int kMaxBlockLength = 64;
+  static const size_t kMaxBlockSize = 16384;
+  static const size_t kCodeSize = 16 * 1024 * 1024;
+  static const unsigned int kJumpCacheSize = 4096;
+  static const unsigned int kMaxPageWrites = 8;
+
+  struct Block {
+    Block() : code(NULL), hits(0) {}
+    JitCode code;
+    unsigned int hits;
+  };
+
+  // Jump cache entry, looked up by translated JALRs (the layout is
+  // known to translated code)
+  struct JumpEntry {
+    Word paddr;
+    Word vaddr;
+    JitCode code;
+  };
+
+  // Jump to the code handing an instruction back to the interpreter
+  struct BailJump {
+    Word pc;
+    uint8_t *rel;
+  };
+
+  static uint64_t blockKey(Word vaddr, Word paddr) {
+    return ((uint64_t)vaddr << 32) | paddr;
+  }
+
+  bool writtenOften(Word paddr) const;
+  bool setWritable(bool writable);
+
+  JitCode translate(Word vaddr, Word paddr);
+  bool translateInstr(Word instr, Word pc);
+  void emitMemAccess(Word instr, Word pc);
+  void emitBranch(Word instr, Word pc, Word vaddr, Word paddr);
+  void emitJump(Word vaddr, Word paddr);
+  void emitExit(Word target, Word vaddr, Word paddr);
+
+  void emitByte(uint8_t b) { *cur++ = b; }
+  void emitWord(Word w);
+  void emitPointer(const void *p);
+  void emitLoad(unsigned int hostReg, unsigned int reg);
+  void emitStore(unsigned int reg);
+  void emitSetCC(uint8_t cc);
+  void emitBail(uint8_t cc, Word pc);
+  void emitPageLookup(const void *dir, Word pc);
+
+  SystemBus *const bus;
+
+  uint8_t *code;
+  uint8_t *cur;
+
+  typedef std::unordered_map<uint64_t, Block> BlockMap;
+  BlockMap blocks;
+
+  // Block exits waiting for their target to be translated
+  typedef std::multimap<uint64_t, uint8_t *> ChainMap;
+  ChainMap pendingChains;
+
+  scoped_array<JumpEntry> jumpCache;
+
+  // Bail jumps of the block being translated
+  std::vector<BailJump> bailJumps;
+
+  // One bit for each physical page code was translated from
+  scoped_array<uint32_t> codePages;
+  bool hasCode;
+
+  // Number of times code was discarded because of a write to each page
+  std::unordered_map<Word, unsigned int> pageWrites;
+
+  DISABLE_COPY_AND_ASSIGNMENT(Jit);
+};
+
+inline bool Jit::HasCode(Word paddr) const {
+  Word pfn = paddr >> 12;
+  return hasCode && (codePages[pfn >> 5] & (1U << (pfn & 31)));
+}
+
+inline void Jit::Invalidate(Word paddr) {
+  if (HasCode(paddr)) {
+    pageWrites[paddr >> 12]++;
+    Flush();
+  }
+}
+
+#endif // URISCV_JIT_H
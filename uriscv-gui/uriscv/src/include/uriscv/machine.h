@@ -22,9 +22,13 @@
 #ifndef URISCV_MACHINE_H
 #define URISCV_MACHINE_H
 
+#include <atomic>
+#include <string>
+#include <thread>
 #include <vector>
 
 #include "base/lang.h"
+#include "base/trackable_mixin.h"
 #include "uriscv/device.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/stoppoint.h"
@@ -44,16 +48,17 @@ class Processor;
 class SystemBus;
 class Device;
 class StoppointSet;
+class WorkerPool;
 
-class Machine {
+class Machine : public TrackableMixin {
 public:
   Machine(const MachineConfig *config, StoppointSet *breakpoints,
           StoppointSet *suspects, StoppointSet *tracepoints);
   ~Machine();
 
+  uint32_t run(uint32_t budget, bool *stopped = NULL);
+
   void step(bool *stopped = NULL);
-  void step(unsigned int steps, unsigned int *stepped = NULL,
-            bool *stopped = NULL);
 
   uint32_t idleCycles() const;
   void skip(uint32_t cycles);
@@ -61,6 +66,25 @@ public:
   void Halt();
   bool IsHalted() const { return halted; }
 
+  // These methods save the full machine state to the snapshot file
+  // fileName, and restore it (or a checkpoint, see Checkpoint()) into
+  // a machine created with the same configuration; they throw the
+  // exceptions in error.h on failure
+  void Save(const std::string &fileName) const;
+  void Restore(const std::string &fileName);
+
+  // This method writes a checkpoint of the machine to fileName: a
+  // snapshot holding only the RAM pages written since the checkpoint
+  // parent was taken (a full one if parent is empty), which Restore()
+  // restores over its parent. parent is relative to the directory of
+  // fileName. The state is copied in memory, and the file is written
+  // on a host thread of its own meanwhile the machine runs on; write
+  // errors are thrown by the next call or by FinishCheckpoint()
+  void Checkpoint(const std::string &fileName, const std::string &parent);
+
+  // This method waits until the last checkpoint has been written
+  void FinishCheckpoint();
+
   Processor *getProcessor(unsigned int cpuId);
   Device *getDevice(unsigned int line, unsigned int devNo);
   SystemBus *getBus();
@@ -78,6 +102,17 @@ public:
   void HandleBusAccess(Word pAddr, Word access, Processor *cpu);
   void HandleVMAccess(Word asid, Word vaddr, Word access, Processor *cpu);
 
+  // These methods serve processors running in blocks while stoppoints
+  // are active (see Processor::ExecBlock()), which end as soon as a stop
+  // is requested: whether one has been, whether breakpoints may stop
+  // the machine at fetches from the page holding vaddr (paddr once
+  // translated) in address space asid, and whether suspects may stop it
+  bool StopRequested() const {
+    return stopRequested.load(std::memory_order_relaxed);
+  }
+  bool BreakpointsOnPage(Word asid, Word vaddr, Word paddr) const;
+  bool SuspectsActive() const;
+
   void setStab(SymbolTable *stab);
   SymbolTable *getStab();
 
@@ -88,6 +123,20 @@ private:
     unsigned int suspectId;
   };
 
+  // Upper bound on the clock ticks processors run in parallel before
+  // synchronizing with each other and with the bus
+  static const uint32_t kMaxQuantum = 20000;
+
+  Processor *blockProcessor() const;
+  bool stoppointsActive() const;
+  void runParallel(uint32_t quantum);
+
+  void onStoppointsChanged();
+  void updatePageMap();
+
+  void saveState(SnapshotWriter &out, const std::string &parent) const;
+  std::string restoreState(const std::string &fileName, bool chainOnly);
+
   void onCpuStatusChanged(const Processor *cpu);
   void onCpuException(unsigned int, Processor *cpu);
 
@@ -103,14 +152,29 @@ private:
   ProcessorData pd[MachineConfig::MAX_CPUS];
 
   bool halted;
-  bool stopRequested;
-  bool pauseRequested;
+
+  // Set from the processors' host threads in parallel quanta
+  std::atomic<bool> stopRequested;
+  std::atomic<bool> pauseRequested;
+
+  // Host threads running processors in parallel (see runParallel()),
+  // started on first use
+  scoped_ptr<WorkerPool> workers;
+
+  // Set when stoppoints have been added or removed since the bus page
+  // map was last updated
+  bool pageMapStale;
 
   StoppointSet *breakpoints;
   StoppointSet *suspects;
   StoppointSet *tracepoints;
 
   SymbolTable *stab;
+
+  // Host thread writing the last checkpoint, and the error it failed
+  // with (if any)
+  std::thread checkpointThread;
+  std::string checkpointError;
 };
 
 #endif // URISCV_MACHINE_H
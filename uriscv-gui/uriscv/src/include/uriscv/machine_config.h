@@ -43,8 +43,10 @@ enum ROMType {
 
 class MachineConfig {
 public:
+  // RAM sizes are in frames; RAM may extend up to the start of kuseg,
+  // and host memory is only used for the frames the guest touches
   static const Word MIN_RAM = 8;
-  static const Word MAX_RAM = 512;
+  static const Word MAX_RAM = (KUSEGBASE - RAMBASE) / (FRAMESIZE * FRAMEKB);
   static const Word DEFAUlT_RAM_SIZE = 64;
 
   static const unsigned int MIN_CPUS = 1;
@@ -70,6 +72,14 @@ public:
                                      std::string &error);
   static MachineConfig *Create(const std::string &fileName);
 
+  // These methods map a device name, as used for the keys of the
+  // "devices" section (e.g. "terminal0"), to its interrupt line index
+  // and device number and back; ParseDeviceName() returns false if
+  // name is not a device name
+  static bool ParseDeviceName(const std::string &name, unsigned int *il,
+                              unsigned int *devNo);
+  static std::string DeviceName(unsigned int il, unsigned int devNo);
+
   const std::string &getFileName() const { return fileName; }
 
   void Save();
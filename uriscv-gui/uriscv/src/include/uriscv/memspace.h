@@ -22,19 +22,30 @@
 #ifndef URISCV_MEMSPACE_H
 #define URISCV_MEMSPACE_H
 
+#include <cstddef>
+
 #include "base/lang.h"
 #include "uriscv/types.h"
 
+class SnapshotWriter;
+class SnapshotReader;
+
 // This class implements the RAM device. Any object allows reads and
 // writes with random access to word-sized items using appropriate
 // methods. Contents may be loaded from file at creation. SystemBus
-// must do all bounds checking and address conversion for access
+// must do all bounds checking and address conversion for access.
+// Memory is a private anonymous mapping, and a core file is mapped
+// (copy-on-write) rather than read into it: host pages are only
+// allocated and read in when first touched. Writes made through
+// MemWrite() mark their page dirty, for incremental checkpoints (see
+// Machine::Checkpoint())
 
 class RamSpace {
 public:
   // This method creates a RamSpace object of a given size (in words)
   // and fills it with file contents if needed
   RamSpace(Word size_, const char *fName);
+  ~RamSpace();
 
   // This method returns the value of Word at index
   Word MemRead(Word index) const { return ram[index]; }
@@ -42,16 +53,65 @@ public:
   // This method allows to write data to a specified address (as word
   // offset). SystemBus must check address validity and make
   // byte-to-word address conversion)
-  void MemWrite(Word index, Word data) { ram[index] = data; }
+  void MemWrite(Word index, Word data) {
+    ram[index] = data;
+    markDirty(index);
+  }
+
+  // This method writes only the bytes of data selected by mask (e.g. a
+  // byte or halfword lane) to the Word at index
+  void MemWrite(Word index, Word data, Word mask) {
+    ram[index] = (ram[index] & ~mask) | (data & mask);
+    markDirty(index);
+  }
+
+  // This method returns a pointer to the Word at index, for SystemBus
+  // to access memory directly
+  Word *MemPtr(Word index) { return &ram[index]; }
 
   // This method returns RamSpace size in bytes
   Word Size() const { return size << 2; }
 
+  // These methods tell whether the page (of kPageWords words) at
+  // index page has been written since ClearDirty() was last called;
+  // direct writes through MemPtr() are not tracked, and the caller
+  // must not make them to clean pages
+  bool IsDirty(Word page) const {
+    return dirty[page >> 5] & (1U << (page & 31));
+  }
+  void ClearDirty();
+
+  // These methods save RamSpace contents to a snapshot and restore
+  // them; the size must match. Only pages holding nonzero words are
+  // saved, or only dirty ones if dirtyOnly, for a snapshot that is
+  // restored over the one taken when ClearDirty() was last called.
+  // Restored pages are all dirty
+  void Save(SnapshotWriter &out, bool dirtyOnly = false) const;
+  void Restore(SnapshotReader &in);
+
+  static const unsigned int kPageShift = 10;
+  static const Word kPageWords = 1U << kPageShift;
+
 private:
-  scoped_array<Word> ram;
+  void markDirty(Word index) {
+    dirty[index >> (kPageShift + 5)] |= 1U << ((index >> kPageShift) & 31);
+  }
+
+  // host mapping holding the memory contents, which start one word
+  // into it (where they are in a core file, after its tag)
+  void *mapping;
+  size_t mappingSize;
+
+  Word *ram;
 
   // size of structure in words (C style addressing: [0..size - 1])
   Word size;
+
+  // dirty pages (one bit each)
+  Word numPages;
+  scoped_array<uint32_t> dirty;
+
+  DISABLE_COPY_AND_ASSIGNMENT(RamSpace);
 };
 
 // This class implements ROM devices. The BIOS or Bootstrap ROM is read
@@ -61,22 +121,33 @@ private:
 
 class BiosSpace {
 public:
-  // This method creates a BiosSpace object, filling with .rom file
-  // contents
+  // This method creates a BiosSpace object, mapping .rom file
+  // contents (read-only)
   BiosSpace(const char *name);
+  ~BiosSpace();
 
   // This method returns the value of Word at ofs address
   // (SystemBus must assure that ofs is in range)
   Word MemRead(Word ofs);
 
+  // This method returns a pointer to the Word at ofs address, for
+  // SystemBus to access memory directly
+  const Word *MemPtr(Word ofs) const { return &memPtr[ofs]; }
+
   // This method returns BiosSpace size in bytes
   Word Size();
 
 private:
-  scoped_array<Word> memPtr;
+  // host mapping of the whole .rom file, header included
+  void *mapping;
+  size_t mappingSize;
+
+  const Word *memPtr;
 
   // size of structure in Words (C style addressing: [0..size - 1])
   Word size;
+
+  DISABLE_COPY_AND_ASSIGNMENT(BiosSpace);
 };
 
 #endif // URISCV_MEMSPACE_H
@@ -29,6 +29,8 @@
 
 class SystemBus;
 class Processor;
+class SnapshotWriter;
+class SnapshotReader;
 
 class InterruptController {
 public:
@@ -44,6 +46,13 @@ public:
 
   Word GetIP(Word cpuId) const { return cpuData[cpuId].ipMask << (0); }
 
+  // This method delivers the IPI message in outbox, sent by cpu origin
+  // kIpiLatency ticks earlier
+  void DeliverIPI(unsigned int origin, Word outbox);
+
+  void Save(SnapshotWriter &out) const;
+  void Restore(SnapshotReader &in);
+
 private:
   static const unsigned int kBaseIL = 16;
   static const unsigned int kSharedILBase = 1;
@@ -88,8 +97,6 @@ private:
     Word biosReserved[2];
   };
 
-  void deliverIPI(unsigned int origin, Word outbox);
-
   const MachineConfig *const config;
   SystemBus *const bus;
 
@@ -36,6 +36,11 @@ class MachineConfig;
 class Machine;
 class SystemBus;
 class TLBEntry;
+class DecodeCache;
+struct DecodedInstr;
+class Jit;
+class SnapshotWriter;
+class SnapshotReader;
 
 enum ProcessorStatus { PS_HALTED, PS_RUNNING, PS_IDLE };
 
@@ -45,6 +50,12 @@ public:
   static const unsigned int kNumCPURegisters = 32;
   static const unsigned int kNumCSRRegisters = 4096;
 
+  // Instrumentation the execution loop can be specialized on: tracing
+  // of executed instructions (DISASS) and notification of virtual
+  // address accesses to Machine, for stoppoint checking
+  enum ExecFeature { EF_TRACE = 1 << 0, EF_WATCH = 1 << 1 };
+  static const unsigned int kAllExecFeatures = EF_TRACE | EF_WATCH;
+
   Processor(const MachineConfig *config, Word id, Machine *machine,
             SystemBus *bus);
   virtual ~Processor();
@@ -69,9 +80,34 @@ public:
   // execution happens
   void Cycle();
 
-  uint32_t IdleCycles();
+  // This method makes Processor run a sequence of instructions in a
+  // single call, with the same results as as many Cycle() calls (and
+  // bus clock ticks). It must only be used when no other processor is
+  // running and the next cycles bus ticks have no side effects (see
+  // SystemBus::IdleCycles()); it returns the number of cycles actually
+  // run, which is 0 when the current instruction needs Cycle()
+  uint32_t ExecBlock(uint32_t cycles);
+
+  // This method makes Processor run up to cycles clock ticks of a
+  // quantum (see Machine::run()) on its own: the bus clock is not
+  // advanced, the processor keeping track of the ticks it has run
+  // until EndQuantum() is called. With parallel set, the processor may
+  // be running on a host thread of its own, so it stops (returning the
+  // ticks actually run) before anything SystemBus::ParallelSafe() does
+  // not allow and before any instruction that needs Cycle(); otherwise
+  // all cycles are run
+  uint32_t RunQuantum(uint32_t cycles, bool parallel);
+
+  // This method ends a quantum, once the bus clock has been brought
+  // up to the processor one
+  void EndQuantum();
+
+  // This method selects the instrumentation compiled into the
+  // execution loop run by Cycle() and ExecBlock(): features is a mask
+  // of ExecFeature values, and defaults to all of them
+  void setExecFeatures(unsigned int features);
 
-  void Skip(uint32_t cycles);
+  uint32_t IdleCycles();
 
   // This method allows SystemBus and Processor itself to signal
   // Processor when an exception happens. SystemBus signal IBE/DBE
@@ -81,6 +117,12 @@ public:
   void AssertIRQ(unsigned int il);
   void DeassertIRQ(unsigned int il);
 
+  // These methods save the processor state (registers, CSRs, TLB and
+  // pipeline book-keeping) to a snapshot and restore it; they must not
+  // be called in the middle of a quantum
+  void Save(SnapshotWriter &out) const;
+  void Restore(SnapshotReader &in);
+
   // The following methods allow inspection of Processor internal
   // status. Name & parameters are self-explanatory: remember that
   // all addresses are _virtual_ when not marked Phys/P/phys (for
@@ -152,6 +194,27 @@ private:
   Machine *machine;
   SystemBus *bus;
 
+  // decoded instructions (each processor has its own cache)
+  DecodeCache *decodeCache;
+
+  // JIT compiler (NULL if disabled) and JIT check mode state
+  Jit *jit;
+  uint32_t jitCheckLeft;
+  Word jitCheckPC;
+  SWord jitCheckGPR[kNumCPURegisters];
+
+  // selected instrumentation, and the execution loop instantiations
+  // specialized for it
+  unsigned int execFeatures;
+  void (Processor::*cycleImpl)();
+  uint32_t (Processor::*execBlockImpl)(uint32_t);
+
+  // clock ticks run in the current quantum (see RunQuantum()), and
+  // whether the quantum is being run in parallel with other processors
+  bool inQuantum;
+  bool quantumParallel;
+  uint32_t localTicks;
+
   std::string prevFunc;
   bool skipCycle;
 
@@ -180,7 +243,10 @@ private:
 
   // general purpose registers, together with HI and LO registers
   SWord gpr[kNumCPURegisters];
-  csr_t csr[kNumCSRRegisters];
+
+  // CSRs: the ones accessed on every cycle are kept in their own
+  // members (see below), csr holds all the others out of line
+  scoped_array<Word> csr;
 
   // instruction to be executed
   Word currInstr;
@@ -209,26 +275,116 @@ private:
   size_t tlbSize;
   scoped_array<TLBEntry> tlb;
 
+  // Micro-TLB: a direct-mapped cache of the translations found by
+  // probeTLB(), tagged with the VPN and the ASID they were looked up
+  // with (bit 0 of the tag marks a valid entry). Only translations for
+  // valid entries are cached, so a hit needs no further checks but the
+  // D bit one for writes; it must be flushed whenever the TLB changes.
+  static const unsigned int kMicroTLBSize = 64;
+  struct MicroTLBEntry {
+    Word tag;
+    Word lo;
+  };
+  MicroTLBEntry microTLB[kMicroTLBSize];
+
   Word tlbFloorAddress;
 
-  void initCSR();
+  Word csrMStatus;
+  Word csrMIE;
+  Word csrMIP;
+  Word csrTime;
+  bool timeRunning;
+  uint64_t timeDeadline;
+  Word csrEntryHi;
+  Word csrRandom;
 
   // private methods
   void setStatus(ProcessorStatus newStatus);
 
   void handleExc();
   void zapTLB(void);
-
-  bool execInstr(Word instr);
-  bool execInstrL(Word instr);
-  bool execInstrR(Word instr);
-  bool execInstrI(Word instr);
-  bool execInstrI2(Word instr);
-  bool execInstrB(Word instr);
-  bool execInstrS(Word instr);
-
+  void flushMicroTLB();
+
+  uint64_t clockNow() const;
+
+  Word getTime() const;
+  void setTime(Word value);
+  void updateTimer();
+
+  template <unsigned int F> void selectExecFeatures();
+  template <unsigned int F> void cycle();
+  template <unsigned int F> uint32_t execBlock(uint32_t cycles);
+  template <unsigned int F> void fetchInstr();
+  void advanceClock(uint32_t cycles);
+  uint32_t execJit(uint32_t cycles);
+  void checkJit();
+
+  template <unsigned int F> bool execInstr();
+  template <unsigned int F> void decodeInstr(Word instr, DecodedInstr *di);
+
+  // Decoded instruction handlers: each one executes a single kind of
+  // instruction, whose operands have already been extracted by
+  // decodeInstr(). Like the rest of the execution loop, they are
+  // specialized on a mask F of ExecFeature values
+  template <unsigned int F> bool execIllegal(const DecodedInstr *di);
+  template <unsigned int F> bool execInstrI2(const DecodedInstr *di);
+
+  template <unsigned int F> bool execLB(const DecodedInstr *di);
+  template <unsigned int F> bool execLH(const DecodedInstr *di);
+  template <unsigned int F> bool execLW(const DecodedInstr *di);
+  template <unsigned int F> bool execLBU(const DecodedInstr *di);
+  template <unsigned int F> bool execLHU(const DecodedInstr *di);
+
+  template <unsigned int F> bool execADD(const DecodedInstr *di);
+  template <unsigned int F> bool execSUB(const DecodedInstr *di);
+  template <unsigned int F> bool execMUL(const DecodedInstr *di);
+  template <unsigned int F> bool execMULH(const DecodedInstr *di);
+  template <unsigned int F> bool execSLL(const DecodedInstr *di);
+  template <unsigned int F> bool execMULHSU(const DecodedInstr *di);
+  template <unsigned int F> bool execSLT(const DecodedInstr *di);
+  template <unsigned int F> bool execMULHU(const DecodedInstr *di);
+  template <unsigned int F> bool execSLTU(const DecodedInstr *di);
+  template <unsigned int F> bool execDIV(const DecodedInstr *di);
+  template <unsigned int F> bool execXOR(const DecodedInstr *di);
+  template <unsigned int F> bool execDIVU(const DecodedInstr *di);
+  template <unsigned int F> bool execSRA(const DecodedInstr *di);
+  template <unsigned int F> bool execSRL(const DecodedInstr *di);
+  template <unsigned int F> bool execREM(const DecodedInstr *di);
+  template <unsigned int F> bool execOR(const DecodedInstr *di);
+  template <unsigned int F> bool execREMU(const DecodedInstr *di);
+  template <unsigned int F> bool execAND(const DecodedInstr *di);
+
+  template <unsigned int F> bool execADDI(const DecodedInstr *di);
+  template <unsigned int F> bool execSLLI(const DecodedInstr *di);
+  template <unsigned int F> bool execSLTI(const DecodedInstr *di);
+  template <unsigned int F> bool execSLTIU(const DecodedInstr *di);
+  template <unsigned int F> bool execXORI(const DecodedInstr *di);
+  template <unsigned int F> bool execSRLI(const DecodedInstr *di);
+  template <unsigned int F> bool execSRAI(const DecodedInstr *di);
+  template <unsigned int F> bool execORI(const DecodedInstr *di);
+  template <unsigned int F> bool execANDI(const DecodedInstr *di);
+
+  template <unsigned int F> bool execBEQ(const DecodedInstr *di);
+  template <unsigned int F> bool execBNE(const DecodedInstr *di);
+  template <unsigned int F> bool execBLT(const DecodedInstr *di);
+  template <unsigned int F> bool execBGE(const DecodedInstr *di);
+  template <unsigned int F> bool execBLTU(const DecodedInstr *di);
+  template <unsigned int F> bool execBGEU(const DecodedInstr *di);
+
+  template <unsigned int F> bool execSB(const DecodedInstr *di);
+  template <unsigned int F> bool execSH(const DecodedInstr *di);
+  template <unsigned int F> bool execSW(const DecodedInstr *di);
+
+  template <unsigned int F> bool execAUIPC(const DecodedInstr *di);
+  template <unsigned int F> bool execLUI(const DecodedInstr *di);
+  template <unsigned int F> bool execJAL(const DecodedInstr *di);
+  template <unsigned int F> bool execJALR(const DecodedInstr *di);
+
+  template <unsigned int F>
   bool mapVirtual(Word vaddr, Word *paddr, Word accType);
   bool probeTLB(unsigned int *index, Word asid, Word vpn);
+  bool peekVirtual(Word vaddr, Word *paddr, bool write);
+  bool parallelSafe(const DecodedInstr *di);
   void completeLoad(void);
 
   void randomRegTick(void);
@@ -0,0 +1,91 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef URISCV_SNAPSHOT_H
+#define URISCV_SNAPSHOT_H
+
+#include <cstdio>
+#include <string>
+
+#include "base/lang.h"
+#include "uriscv/types.h"
+
+// These classes implement the file streams Machine state is saved to and
+// restored from (see Machine::Save()). A snapshot starts with a tag and
+// a format version, followed by the state of each component in a fixed
+// order; values are stored in host byte order, so snapshots are only
+// meant to be restored on the host that took them. Errors are reported
+// by throwing the exceptions in error.h.
+
+class SnapshotWriter {
+public:
+  // This method creates the snapshot file fileName, and writes its
+  // header to it; if buffered, all data is kept in memory until
+  // Close(), which may then be called from another host thread
+  explicit SnapshotWriter(const std::string &fileName, bool buffered = false);
+  ~SnapshotWriter();
+
+  void Put(const void *data, size_t size);
+
+  void PutWord(Word w) { Put(&w, sizeof(w)); }
+  void PutU64(uint64_t v) { Put(&v, sizeof(v)); }
+  void PutBool(bool b) { PutWord(b ? 1 : 0); }
+  void PutString(const std::string &s);
+
+  // This method flushes the file and closes it
+  void Close();
+
+private:
+  const std::string fileName;
+  FILE *file;
+
+  const bool buffered;
+  std::string buffer;
+
+  DISABLE_COPY_AND_ASSIGNMENT(SnapshotWriter);
+};
+
+class SnapshotReader {
+public:
+  // This method opens the snapshot file fileName, and checks its
+  // header
+  explicit SnapshotReader(const std::string &fileName);
+  ~SnapshotReader();
+
+  void Get(void *data, size_t size);
+
+  Word GetWord();
+  uint64_t GetU64();
+  bool GetBool() { return GetWord() != 0; }
+  std::string GetString();
+
+  // This method reads a Word and checks that it is expected, throwing
+  // an InvalidFileFormatError otherwise
+  void Expect(Word expected, const char *what);
+
+  const std::string &getFileName() const { return fileName; }
+
+private:
+  const std::string fileName;
+  FILE *file;
+
+  DISABLE_COPY_AND_ASSIGNMENT(SnapshotReader);
+};
+
+#endif // URISCV_SNAPSHOT_H
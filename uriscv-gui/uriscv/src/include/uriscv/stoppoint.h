@@ -30,6 +30,7 @@
 #include <sigc++/sigc++.h>
 
 #include "base/lang.h"
+#include "uriscv/const.h"
 #include "uriscv/types.h"
 
 class Processor;
@@ -58,8 +59,16 @@ public:
 
   bool operator<(const AddressRange &other) const { return LessThan(other); }
 
+  // Ranges for ANYASID overlap those for any other virtual address
+  // space
   bool Overlaps(const AddressRange &r) const {
-    return !(asid != r.asid || r.end < start || r.start > end);
+    return SameSpace(r) && !(r.end < start || r.start > end);
+  }
+
+  bool SameSpace(const AddressRange &r) const {
+    return asid == r.asid ||
+           (asid == ANYASID && r.asid != MAXASID) ||
+           (r.asid == ANYASID && asid != MAXASID);
   }
 
   bool Contains(Word asid, Word addr) const {
@@ -76,10 +85,14 @@ public:
   typedef shared_ptr<Stoppoint const> ConstPtr;
 
   Stoppoint(unsigned int id, const AddressRange &range, AccessMode mode)
-      : id(id), enabled(true), range(range), accessMode(mode) {}
+      : id(id), index(0), enabled(true), range(range), accessMode(mode) {}
 
   unsigned int getId() const { return id; }
 
+  // This method returns the position of the stoppoint in the set
+  // holding it (see StoppointSet::Get())
+  size_t getIndex() const { return index; }
+
   void SetEnabled(bool setting) { enabled = setting; }
   bool IsEnabled() const { return enabled; }
 
@@ -95,7 +108,10 @@ public:
   std::string ToString() const;
 
 private:
+  friend class StoppointSet;
+
   unsigned int id;
+  size_t index;
   bool enabled;
   AddressRange range;
   AccessMode accessMode;
@@ -103,6 +119,7 @@ private:
 
 class StoppointSet {
 public:
+  StoppointSet();
   virtual ~StoppointSet();
 
   size_t Size() const { return points.size(); }
@@ -122,9 +139,17 @@ public:
 
   void SetEnabled(size_t index, bool setting);
 
+  // This method returns the stoppoint (if any) matching an access to
+  // addr in address space asid, ANYASID ones included, and notifies
+  // SignalHit of it
   Stoppoint *Probe(Word asid, Word addr, AccessMode mode,
                    const Processor *cpu) const;
 
+  // This method tells whether any stoppoint may cover the page holding
+  // addr in address space asid, ANYASID ones included; it may return
+  // true for pages no stoppoint covers
+  bool MayCoverPage(Word asid, Word addr) const;
+
   template <typename OutputIterator>
   void GetStoppointsInRange(Word asid, Word start, Word end,
                             OutputIterator out);
@@ -138,14 +163,35 @@ public:
       SignalHit;
 
 private:
+  // Page filter: one bit for each (ASID, page) pair hashed to it, set
+  // if any stoppoint covers that page. A clear bit rules out any
+  // stoppoint on the page, so most probes end at a single bit test
+  static const unsigned int kFilterPageShift = 12;
+  static const unsigned int kFilterBits = 1U << 16;
+
+  static unsigned int filterBit(Word asid, Word page) {
+    return ((asid * 0x9E3779B1U) ^ page) & (kFilterBits - 1);
+  }
+
   unsigned int nextId() const;
 
+  bool filterHas(Word asid, Word addr) const {
+    const unsigned int bit = filterBit(asid, addr >> kFilterPageShift);
+    return pageFilter[bit / 32] & (1U << (bit % 32));
+  }
+  Stoppoint *lookup(Word asid, Word addr, AccessMode mode) const;
+
+  void addToFilter(const AddressRange &range);
+  void rebuildFilter();
+
   typedef std::vector<Stoppoint::Ptr> StoppointVector;
   StoppointVector points;
 
   typedef std::map<AddressRange, Stoppoint *> StoppointMap;
   StoppointMap addressMap;
 
+  std::vector<uint32_t> pageFilter;
+
 public:
   typedef StoppointVector::const_iterator const_iterator;
   typedef const_iterator iterator;
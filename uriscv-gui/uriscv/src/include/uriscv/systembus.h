@@ -23,14 +23,21 @@
 #ifndef URISCV_SYSTEMBUS_H
 #define URISCV_SYSTEMBUS_H
 
+#include <deque>
+#include <string>
+#include <vector>
+
 #include "base/basic_types.h"
 #include "base/lang.h"
 #include "uriscv/const.h"
 #include "uriscv/event.h"
+#include "uriscv/input_log.h"
 #include "uriscv/time_stamp.h"
 
 class Machine;
 class MachineConfig;
+class DecodeCache;
+class Jit;
 class Device;
 class Processor;
 class RamSpace;
@@ -38,6 +45,8 @@ class BiosSpace;
 class Block;
 class MPController;
 class InterruptController;
+class SnapshotWriter;
+class SnapshotReader;
 
 class SystemBus {
 public:
@@ -67,6 +76,12 @@ public:
   // otherwise, and notifies access to Watch control object
   bool DataWrite(Word addr, Word data, Processor *proc);
 
+  // This method writes only the bytes of data selected by mask (the
+  // byte or halfword lane of a SB/SH instruction) to the word at
+  // physical addr, in a single bus transaction; device registers are
+  // still accessed as whole words
+  bool DataWrite(Word addr, Word data, Word mask, Processor *proc);
+
   // This method reads a istruction from memory at physical address addr,
   // returning it thru istrp pointer. It also returns TRUE if the
   // address was invalid and an exception was caused, FALSE otherwise,
@@ -89,7 +104,9 @@ public:
   bool DMAVarTransfer(Block *blk, Word startAddr, Word byteLength,
                       bool toMemory);
 
-  uint64_t scheduleEvent(uint64_t delay, Event::Callback callback);
+  // This method schedules the event described by tag to happen at
+  // (current system time) + delay, and returns its deadline
+  uint64_t scheduleEvent(uint64_t delay, const EventTag &tag);
 
   // This method sets the appropriate bits into intCauseDev[] and
   // IntPendMask to signal device interrupt pending; it notifies
@@ -109,20 +126,35 @@ public:
 
   Machine *getMachine() { return machine; }
 
+  // This method returns the cache of decoded instructions of
+  // processor cpuId; it is kept coherent with memory writes
+  DecodeCache *getDecodeCache(unsigned int cpuId) {
+    return decodeCaches[cpuId];
+  }
+
+  // This method returns the JIT compiler, or NULL if it is disabled
+  Jit *getJit() { return jit.get(); }
+
   // This method returns the Device object with given "coordinates"
   Device *getDev(unsigned int intL, unsigned int dNum);
 
   // These methods allow to inspect or modify  TimeofDay Clock and
   // Interval Timer (typically for simulation reasons)
 
+  uint64_t getToD() const { return tod; }
   Word getToDLO() const { return TimeStamp::getLo(tod); }
   Word getToDHI() const { return TimeStamp::getHi(tod); }
-  Word getTimer() const { return timer; }
+  Word getTimer() const;
 
   void setToDHI(Word hi);
   void setToDLO(Word lo);
   void setTimer(Word time);
 
+  // This method tells whether changes to the clock registers (TOD and
+  // interval timer) have to be notified to Watch on every clock tick;
+  // they are until told otherwise
+  void setClockWatched(bool watched) { clockWatched = watched; }
+
   // These methods allow Watch to inspect or modify single memory
   // locations; they return TRUE if address is invalid or cannot be
   // changed, and FALSE otherwise
@@ -130,7 +162,65 @@ public:
   bool WatchRead(Word addr, Word *datap);
   bool WatchWrite(Word addr, Word data);
 
+  // These methods copy len bytes between buf and memory at physical
+  // address addr, with no alignment requirement, for debuggers: pages
+  // mapped for direct access are read straight from memory. They
+  // return the number of bytes copied, which falls short of len at the
+  // first address that is invalid or cannot be changed
+  size_t DebugRead(Word addr, uint8_t *buf, size_t len);
+  size_t DebugWrite(Word addr, const uint8_t *buf, size_t len);
+
+  // This method maps all RAM and ROM pages for direct access by
+  // DataRead(), DataWrite() and InstrRead(), which skip both the
+  // memory map lookup and Watch notification for them
+  void MapPages();
+
+  // This method unmaps the pages in the physical address range
+  // [start, end], so that accesses to them are notified to Watch
+  void UnmapPages(Word start, Word end);
+
+  // These methods save the state of memory, clock registers, event
+  // queue, interrupt and MP controllers and devices to a snapshot, and
+  // restore it; caches of decoded and translated code are flushed on
+  // restore. If ramDirtyOnly, only the RAM pages written since
+  // ClearDirtyPages() was last called are saved
+  void Save(SnapshotWriter &out, bool ramDirtyOnly = false) const;
+  void Restore(SnapshotReader &in);
+
+  // These methods pass input from outside the simulation to devices:
+  // characters typed at terminal devNo, and changes to the operational
+  // status of a device (see Device::setCondition()). While recording,
+  // inputs take effect at the next clock tick, ahead of the events due
+  // then, which is where a replay applies them; while replaying, inputs
+  // from outside are ignored
+  void TerminalInput(unsigned int devNo, const std::string &text);
+  void setDeviceCondition(unsigned int il, unsigned int devNo, bool working);
+
+  // These methods start logging inputs to file fileName, and replaying
+  // the ones logged to it which are still due
+  void RecordInputs(const std::string &fileName);
+  void ReplayInputs(const std::string &fileName);
+
+  // This method marks all RAM pages clean, and unmaps them for
+  // writing: the first write to each one then takes the slow path,
+  // which marks it dirty and maps it again
+  void ClearDirtyPages();
+
+  // This method tells the bus whether processors are running on
+  // several host threads (see Machine::run()); in the meantime they
+  // may only access memory ParallelSafe() allows
+  void setParallel(bool enabled);
+
+  // This method tells whether a processor running in parallel with
+  // the others may access the word at physical address addr: it must
+  // be RAM, and for writes it must not hold decoded or translated code
+  bool ParallelSafe(Word addr, bool write) const;
+
 private:
+  // Translated code looks pages up in the page map and the code page
+  // bitmap itself
+  friend class Jit;
+
   const MachineConfig *const config;
 
   Machine *const machine;
@@ -139,13 +229,60 @@ private:
 
   scoped_ptr<MPController> mpController;
 
-  // system clock & interval timer
+  // system clock & interval timer (see getTimer())
   uint64_t tod;
-  Word timer;
+  uint64_t timerDeadline;
+  bool clockWatched;
 
   // device events queue
   EventQueue *eventQ;
 
+  // inputs due at a later clock tick (in tick order), and the log they
+  // are recorded to
+  std::deque<ExternalInput> pendingInputs;
+  scoped_ptr<InputLog> inputLog;
+  bool replaying;
+
+  // decoded instructions (one cache for each processor), and the
+  // physical pages any of them has code from (one bit each)
+  std::vector<DecodeCache *> decodeCaches;
+  scoped_array<uint32_t> codePages;
+  scoped_ptr<Jit> jit;
+
+  bool parallel;
+
+  // Set when a page written in parallel may have been cached as code
+  // meanwhile, so that the caches must be flushed afterwards
+  bool codeStale;
+
+  // Physical page map: for each page, a host pointer to the memory
+  // backing it, or NULL if accesses to it must take the slow path
+  // (device registers, unmapped addresses, partial ROM pages and
+  // pages Watch is interested in). ROM pages, and RAM pages not
+  // written since the last ClearDirtyPages(), are only mapped for
+  // reading.
+  // As in the decode caches, the map is two-level: the high bits of
+  // an address select a table, the middle ones a page. Tables are
+  // only allocated for the memory spaces; the other directory entries
+  // point to a shared table of NULL pointers, which is never written
+  static const unsigned int kPageShift = 12;
+  static const unsigned int kNumPages = 1U << (32 - kPageShift);
+  static const unsigned int kPageSize = 1U << kPageShift;
+  static const unsigned int kTableShift = 22;
+  static const unsigned int kTableSize = 1U << (kTableShift - kPageShift);
+  static const unsigned int kDirSize = 1U << (32 - kTableShift);
+  static const Word *noReadTable[kTableSize];
+  static Word *noWriteTable[kTableSize];
+  const Word **readDir[kDirSize];
+  Word **writeDir[kDirSize];
+
+  const Word *&readMap(Word pfn) const {
+    return readDir[pfn >> (kTableShift - kPageShift)][pfn & (kTableSize - 1)];
+  }
+  Word *&writeMap(Word pfn) const {
+    return writeDir[pfn >> (kTableShift - kPageShift)][pfn & (kTableSize - 1)];
+  }
+
   // physical memory spaces
   RamSpace *ram;
   RamSpace *biosdata;
@@ -171,12 +308,31 @@ private:
 
   // This method writes the data at physical address addr, and
   // passes it back thru the datap pointer. It also return FALSE if
-  // the addr is valid and writable, and TRUE otherwise
-  bool busWrite(Word addr, Word data, Processor *cpu = 0);
+  // the addr is valid and writable, and TRUE otherwise; only the
+  // bytes selected by mask are written
+  bool busWrite(Word addr, Word data, Processor *cpu = 0,
+                Word mask = MAXWORDVAL);
 
   // This method accesses the system configuration and constructs
   // the devices needed, linking them to SystemBus object
   Device *makeDev(unsigned int intl, unsigned int dnum);
+
+  // This method maps the full pages of a memory space of size bytes
+  // at physical address base, backed by host memory at mem (writeMem
+  // is the same memory for RAM, and NULL for ROM)
+  void allocMap(Word base, Word size);
+  void mapSpace(Word base, Word size, const Word *mem, Word *writeMem);
+
+  // This method returns the callback running the event described by
+  // tag
+  Event::Callback eventCallback(const EventTag &tag);
+
+  void notifyClockChange();
+
+  void injectInput(ExternalInput input);
+  void applyInput(const ExternalInput &input);
+
+  void invalidateCode(Word addr);
 };
 
 #endif // URISCV_SYSTEMBUS_H
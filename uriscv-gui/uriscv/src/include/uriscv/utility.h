@@ -10,6 +10,9 @@
 
 extern bool DEBUG;
 extern bool DISASS;
+extern bool JIT;
+extern bool JITCHECK;
+extern bool PARALLEL;
 
 #define ERROR(msg)                                                             \
   printf("\n[x] %s\n", msg);                                                   \
@@ -0,0 +1,73 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+#ifndef URISCV_WORKER_POOL_H
+#define URISCV_WORKER_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/function.hpp>
+
+#include "base/lang.h"
+#include "uriscv/types.h"
+
+// This class implements a fixed set of host threads running the same
+// task, each one on its own index, until all of them are done; the
+// calling thread takes part in the work too. It is used by Machine to
+// run processors in parallel.
+
+class WorkerPool {
+public:
+  typedef boost::function<void(unsigned int)> Task;
+
+  // This method creates a pool able to run tasks on up to size
+  // indexes, starting size - 1 threads
+  explicit WorkerPool(unsigned int size);
+  ~WorkerPool();
+
+  unsigned int Size() const { return workers.size() + 1; }
+
+  // This method runs task(0), ..., task(Size() - 1) concurrently,
+  // task(0) on the calling thread, and returns when all of them have
+  // returned
+  void Run(const Task &task);
+
+private:
+  void workerMain(unsigned int index);
+
+  std::vector<std::thread> workers;
+
+  std::mutex mutex;
+  std::condition_variable started;
+  std::condition_variable finished;
+
+  // Task being run, generation of the current run (each worker runs a
+  // task once per generation), workers still running it
+  const Task *task;
+  uint64_t generation;
+  unsigned int running;
+  bool quit;
+
+  DISABLE_COPY_AND_ASSIGNMENT(WorkerPool);
+};
+
+#endif // URISCV_WORKER_POOL_H
@@ -0,0 +1,88 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the DecodeCache class, used by Processor to
+ * avoid decoding the same instruction word each time it is executed.
+ * Decoded instructions are kept in pages that mirror physical memory
+ * pages; a page is allocated the first time an instruction is executed
+ * from it, and its slots are invalidated one by one as SystemBus
+ * notifies writes to memory.
+ *
+ ****************************************************************************/
+
+#include "uriscv/decode_cache.h"
+
+#include <cstring>
+
+// This method creates a new (empty) cache
+DecodeCache::DecodeCache(uint32_t *codePages)
+    : codePages(codePages), lastPfn(0), lastPage(NULL) {
+  for (unsigned int i = 0; i < kDirSize; i++)
+    dir[i] = NULL;
+}
+
+// This method deletes the cache and all the pages it contains
+DecodeCache::~DecodeCache() {
+  for (unsigned int i = 0; i < kDirSize; i++) {
+    if (dir[i] == NULL)
+      continue;
+    for (unsigned int j = 0; j < kTableSize; j++)
+      delete dir[i][j];
+    delete[] dir[i];
+  }
+}
+
+// This method discards all the decoded instructions (pages are kept,
+// since code is likely to be executed from them again)
+void DecodeCache::Flush() {
+  for (unsigned int i = 0; i < kDirSize; i++) {
+    if (dir[i] == NULL)
+      continue;
+    for (unsigned int j = 0; j < kTableSize; j++)
+      if (dir[i][j] != NULL)
+        for (unsigned int k = 0; k < kPageSlots; k++)
+          dir[i][j]->slot[k].handler = NULL;
+  }
+}
+
+// This method returns the page with frame number pfn, allocating it
+// (and its table) if needed
+DecodeCache::Page *DecodeCache::getPage(Word pfn) {
+  Page **&table = dir[pfn >> (kTableShift - kPageShift)];
+  if (table == NULL) {
+    table = new Page *[kTableSize];
+    std::memset(table, 0, kTableSize * sizeof(Page *));
+  }
+
+  Page *&page = table[pfn & (kTableSize - 1)];
+  if (page == NULL) {
+    page = new Page;
+    for (unsigned int k = 0; k < kPageSlots; k++)
+      page->slot[k].handler = NULL;
+    // Other processors' caches may be marking pages at the same time,
+    // and the page must be marked before code is read from it (see
+    // SystemBus::invalidateCode())
+    __atomic_fetch_or(&codePages[pfn >> 5], 1U << (pfn & 31),
+                      __ATOMIC_SEQ_CST);
+  }
+
+  return page;
+}
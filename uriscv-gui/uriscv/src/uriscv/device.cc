@@ -38,8 +38,6 @@
 #include <stdio.h>
 #include <string.h>
 
-#include <boost/bind/bind.hpp>
-
 #include "uriscv/blockdev_params.h"
 #include "uriscv/types.h"
 #include <uriscv/const.h>
@@ -53,11 +51,10 @@
 #include "uriscv/error.h"
 #include "uriscv/machine.h"
 #include "uriscv/machine_config.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/time_stamp.h"
 #include "uriscv/vde_network.h"
 
-using namespace boost::placeholders;
-
 // last operation result description
 HIDDEN const char *const opResult[2] = {"UNSUCCESSFUL", "SUCCESSFUL"};
 
@@ -193,6 +190,12 @@ HIDDEN char strbuf[STRBUFSIZE];
 // has been successful or not
 HIDDEN const char *isSuccess(unsigned int devType, Word regVal);
 
+// These functions save and restore the contents of a Block, and of a
+// status string buffer of size bytes
+HIDDEN void saveBlock(SnapshotWriter &out, Block *blk);
+HIDDEN void restoreBlock(SnapshotReader &in, Block *blk);
+HIDDEN void restoreStatStr(SnapshotReader &in, char *buf, size_t size);
+
 /****************************************************************************/
 /* Definitions to be exported.                                              */
 /****************************************************************************/
@@ -289,10 +292,29 @@ void Device::Input(const char *inputstr) {
   Panic("Input directed to a non-Terminal device in Device::Input()");
 }
 
+// This method switches the device to a new host file: not operational for
+// devices without one (NULLDEV included), and produces a panic message
+void Device::setFile(const std::string &fileName) {
+  Panic("File change directed to an unsupported device in Device::setFile()");
+}
+
 bool Device::isBusy() const { return reg[STATUS] == BUSY; }
 
 uint64_t Device::scheduleIOEvent(uint64_t delay) {
-  return bus->scheduleEvent(delay, boost::bind(&Device::CompleteDevOp, this));
+  return bus->scheduleEvent(delay,
+                            EventTag(EventTag::ET_DEVICE_OP, intL, devNum));
+}
+
+void Device::Save(SnapshotWriter &out) const {
+  out.Put(reg, sizeof(reg));
+  out.PutU64(complTime);
+  out.PutBool(isWorking);
+}
+
+void Device::Restore(SnapshotReader &in) {
+  in.Get(reg, sizeof(reg));
+  complTime = in.GetU64();
+  isWorking = in.GetBool();
 }
 
 /****************************************************************************/
@@ -318,12 +340,8 @@ PrinterDevice::PrinterDevice(SystemBus *bus, const MachineConfig *cfg,
   reg[STATUS] = READY;
   sprintf(statStr, "Idle");
 
-  if ((prntFile = fopen(config->getDeviceFile(il, devNo).c_str(), "w")) ==
-      NULL) {
-    sprintf(strbuf, "Cannot open printer %u file : %s", devNum,
-            strerror(errno));
-    Panic(strbuf);
-  }
+  prntFile = NULL;
+  setFile(config->getDeviceFile(il, devNo));
 }
 
 PrinterDevice::~PrinterDevice() {
@@ -396,6 +414,30 @@ void PrinterDevice::WriteDevReg(unsigned int regnum, Word data) {
 
 const char *PrinterDevice::getDevSStr() { return statStr; }
 
+void PrinterDevice::Save(SnapshotWriter &out) const {
+  Device::Save(out);
+  out.PutString(statStr);
+}
+
+void PrinterDevice::Restore(SnapshotReader &in) {
+  Device::Restore(in);
+  restoreStatStr(in, statStr, sizeof(statStr));
+}
+
+void PrinterDevice::setFile(const std::string &fileName) {
+  FILE *file;
+
+  if ((file = fopen(fileName.c_str(), "w")) == NULL) {
+    sprintf(strbuf, "Cannot open printer %u file : %s", devNum,
+            strerror(errno));
+    Panic(strbuf);
+  }
+
+  if (prntFile != NULL)
+    fclose(prntFile);
+  prntFile = file;
+}
+
 unsigned int PrinterDevice::CompleteDevOp() {
   // checks which operation must be completed: for each, sets device
   // register, performs requested operation and produces an interrupt
@@ -472,16 +514,8 @@ TerminalDevice::TerminalDevice(SystemBus *bus, const MachineConfig *cfg,
   recvIntPend = false;
   tranIntPend = false;
 
-  // tries to open log file
-  if ((termFile = fopen(config->getDeviceFile(il, devNo).c_str(), "w")) ==
-      NULL) {
-    sprintf(strbuf, "Cannot open terminal %u file : %s", devNum,
-            strerror(errno));
-    Panic(strbuf);
-  }
-  // else file has been open with success: set it to no buffering for quick
-  // terminal screen update
-  setvbuf(termFile, (char *)NULL, _IONBF, 0);
+  termFile = NULL;
+  setFile(config->getDeviceFile(il, devNo));
 }
 
 TerminalDevice::~TerminalDevice() {
@@ -621,6 +655,58 @@ const char *TerminalDevice::getDevSStr() {
 
 const char *TerminalDevice::getTXStatus() const { return tranStatStr; }
 
+void TerminalDevice::Save(SnapshotWriter &out) const {
+  Device::Save(out);
+  // only the part of the receiver buffer still to be received
+  out.PutString(recvBuf != NULL ? &recvBuf[recvBp] : "");
+  out.PutString(tranBuf);
+  out.PutString(recvStatStr);
+  out.PutString(tranStatStr);
+  out.PutU64(recvCTime);
+  out.PutU64(tranCTime);
+  out.PutBool(recvIntPend);
+  out.PutBool(tranIntPend);
+}
+
+void TerminalDevice::Restore(SnapshotReader &in) {
+  Device::Restore(in);
+
+  std::string input = in.GetString();
+  delete[] recvBuf;
+  recvBuf = NULL;
+  recvBp = 0;
+  if (!input.empty()) {
+    recvBuf = new char[input.size() + 1];
+    strcpy(recvBuf, input.c_str());
+  }
+
+  tranBuf = in.GetString();
+  restoreStatStr(in, recvStatStr, sizeof(recvStatStr));
+  restoreStatStr(in, tranStatStr, sizeof(tranStatStr));
+  recvCTime = in.GetU64();
+  tranCTime = in.GetU64();
+  recvIntPend = in.GetBool();
+  tranIntPend = in.GetBool();
+}
+
+void TerminalDevice::setFile(const std::string &fileName) {
+  FILE *file;
+
+  // tries to open log file
+  if ((file = fopen(fileName.c_str(), "w")) == NULL) {
+    sprintf(strbuf, "Cannot open terminal %u file : %s", devNum,
+            strerror(errno));
+    Panic(strbuf);
+  }
+  // else file has been open with success: set it to no buffering for quick
+  // terminal screen update
+  setvbuf(file, (char *)NULL, _IONBF, 0);
+
+  if (termFile != NULL)
+    fclose(termFile);
+  termFile = file;
+}
+
 const char *TerminalDevice::getRXStatus() const { return recvStatStr; }
 
 std::string TerminalDevice::getCTimeInfo() const {
@@ -815,31 +901,10 @@ DiskDevice::DiskDevice(SystemBus *bus, const MachineConfig *cfg,
   sprintf(statStr, "Idle");
   diskBuf = new Block();
 
-  // tries to access disk image file
-  if ((diskFile = fopen(config->getDeviceFile(intL, devNum).c_str(), "r+")) ==
-      NULL) {
-    sprintf(strbuf, "Cannot open disk %u file : %s", devNum, strerror(errno));
-    Panic(strbuf);
-  }
-
-  // else file has been open with success: tests if it is a valid disk file
-  diskP = new DiskParams(diskFile, &diskOfs);
-
-  if (diskOfs == 0) {
-    // file is not a valid disk file
-    sprintf(strbuf, "Cannot open disk %u file : invalid/corrupted file",
-            devNum);
-    Panic(strbuf);
-  }
-
-  // DATA1 format == drive geometry: CYL CYL HEAD SECT
-  reg[DATA1] = (diskP->getCylNum() << HWORDLEN) |
-               (diskP->getHeadNum() << BYTELEN) | diskP->getSectNum();
-
+  diskFile = NULL;
+  diskP = NULL;
   currCyl = 0;
-  sectTicks =
-      (diskP->getRotTime() * config->getClockRate()) / diskP->getSectNum();
-  cylBuf = headBuf = sectBuf = MAXWORDVAL;
+  setFile(config->getDeviceFile(intL, devNum));
 }
 
 DiskDevice::~DiskDevice() {
@@ -1032,6 +1097,66 @@ void DiskDevice::WriteDevReg(unsigned int regnum, Word data) {
 
 const char *DiskDevice::getDevSStr() { return statStr; }
 
+void DiskDevice::Save(SnapshotWriter &out) const {
+  Device::Save(out);
+  out.PutString(statStr);
+  saveBlock(out, diskBuf);
+  out.PutWord(cylBuf);
+  out.PutWord(headBuf);
+  out.PutWord(sectBuf);
+  out.PutWord(currCyl);
+  out.PutU64(ftell(diskFile));
+}
+
+void DiskDevice::Restore(SnapshotReader &in) {
+  Device::Restore(in);
+  restoreStatStr(in, statStr, sizeof(statStr));
+  restoreBlock(in, diskBuf);
+  cylBuf = in.GetWord();
+  headBuf = in.GetWord();
+  sectBuf = in.GetWord();
+  currCyl = in.GetWord();
+  fseek(diskFile, in.GetU64(), SEEK_SET);
+}
+
+void DiskDevice::setFile(const std::string &fileName) {
+  FILE *file;
+  SWord ofs;
+
+  // tries to access disk image file
+  if ((file = fopen(fileName.c_str(), "r+")) == NULL) {
+    sprintf(strbuf, "Cannot open disk %u file : %s", devNum, strerror(errno));
+    Panic(strbuf);
+  }
+
+  // else file has been open with success: tests if it is a valid disk file
+  DiskParams *params = new DiskParams(file, &ofs);
+
+  if (ofs == 0) {
+    // file is not a valid disk file
+    sprintf(strbuf, "Cannot open disk %u file : invalid/corrupted file",
+            devNum);
+    Panic(strbuf);
+  }
+
+  if (diskFile != NULL)
+    fclose(diskFile);
+  delete diskP;
+  diskFile = file;
+  diskP = params;
+  diskOfs = ofs;
+
+  // DATA1 format == drive geometry: CYL CYL HEAD SECT
+  reg[DATA1] = (diskP->getCylNum() << HWORDLEN) |
+               (diskP->getHeadNum() << BYTELEN) | diskP->getSectNum();
+
+  if (currCyl >= diskP->getCylNum())
+    currCyl = 0;
+  sectTicks =
+      (diskP->getRotTime() * config->getClockRate()) / diskP->getSectNum();
+  cylBuf = headBuf = sectBuf = MAXWORDVAL;
+}
+
 unsigned int DiskDevice::CompleteDevOp() {
   // for file access
   SWord blkOfs;
@@ -1175,29 +1300,9 @@ FlashDevice::FlashDevice(SystemBus *bus, const MachineConfig *cfg,
   sprintf(statStr, "Idle");
   flashBuf = new Block();
 
-  // tries to access flash device image file
-  if ((flashFile = fopen(config->getDeviceFile(intL, devNum).c_str(), "r+")) ==
-      NULL) {
-    sprintf(strbuf, "Cannot open flash device %u file : %s", devNum,
-            strerror(errno));
-    Panic(strbuf);
-  }
-
-  // else file has been open with success: tests if it is a valid flash device
-  // file
-  flashP = new FlashParams(flashFile, &flashOfs);
-
-  if (flashOfs == 0) {
-    // file is not a valid flash device file
-    sprintf(strbuf, "Cannot open flash device %u file : invalid/corrupted file",
-            devNum);
-    Panic(strbuf);
-  }
-
-  // DATA1 format == drive geometry: BLOCKS
-  reg[DATA1] = flashP->getBlocksNum();
-
-  blockBuf = MAXWORDVAL;
+  flashFile = NULL;
+  flashP = NULL;
+  setFile(config->getDeviceFile(intL, devNum));
 }
 
 FlashDevice::~FlashDevice() {
@@ -1324,6 +1429,57 @@ void FlashDevice::WriteDevReg(unsigned int regnum, Word data) {
 
 const char *FlashDevice::getDevSStr() { return statStr; }
 
+void FlashDevice::Save(SnapshotWriter &out) const {
+  Device::Save(out);
+  out.PutString(statStr);
+  saveBlock(out, flashBuf);
+  out.PutWord(blockBuf);
+  out.PutU64(ftell(flashFile));
+}
+
+void FlashDevice::Restore(SnapshotReader &in) {
+  Device::Restore(in);
+  restoreStatStr(in, statStr, sizeof(statStr));
+  restoreBlock(in, flashBuf);
+  blockBuf = in.GetWord();
+  fseek(flashFile, in.GetU64(), SEEK_SET);
+}
+
+void FlashDevice::setFile(const std::string &fileName) {
+  FILE *file;
+  SWord ofs;
+
+  // tries to access flash device image file
+  if ((file = fopen(fileName.c_str(), "r+")) == NULL) {
+    sprintf(strbuf, "Cannot open flash device %u file : %s", devNum,
+            strerror(errno));
+    Panic(strbuf);
+  }
+
+  // else file has been open with success: tests if it is a valid flash device
+  // file
+  FlashParams *params = new FlashParams(file, &ofs);
+
+  if (ofs == 0) {
+    // file is not a valid flash device file
+    sprintf(strbuf, "Cannot open flash device %u file : invalid/corrupted file",
+            devNum);
+    Panic(strbuf);
+  }
+
+  if (flashFile != NULL)
+    fclose(flashFile);
+  delete flashP;
+  flashFile = file;
+  flashP = params;
+  flashOfs = ofs;
+
+  // DATA1 format == drive geometry: BLOCKS
+  reg[DATA1] = flashP->getBlocksNum();
+
+  blockBuf = MAXWORDVAL;
+}
+
 unsigned int FlashDevice::CompleteDevOp() {
   // for file access
   SWord blkOfs;
@@ -1562,6 +1718,24 @@ void EthDevice::WriteDevReg(unsigned int regnum, Word data) {
 
 const char *EthDevice::getDevSStr() { return statStr; }
 
+// The host network interface state (mode, MAC address, queued packets)
+// is not part of the snapshot
+void EthDevice::Save(SnapshotWriter &out) const {
+  Device::Save(out);
+  out.PutString(statStr);
+  saveBlock(out, readbuf);
+  saveBlock(out, writebuf);
+  out.PutBool(polling);
+}
+
+void EthDevice::Restore(SnapshotReader &in) {
+  Device::Restore(in);
+  restoreStatStr(in, statStr, sizeof(statStr));
+  restoreBlock(in, readbuf);
+  restoreBlock(in, writebuf);
+  polling = in.GetBool();
+}
+
 unsigned int EthDevice::CompleteDevOp() {
   int rp = reg[STATUS] & READPENDING;
   const bool busy = (reg[STATUS] & READPENDINGMASK) == BUSY;
@@ -1686,3 +1860,18 @@ unsigned int EthDevice::CompleteDevOp() {
 bool EthDevice::isBusy() const {
   return (reg[STATUS] & READPENDINGMASK) == BUSY;
 }
+
+HIDDEN void saveBlock(SnapshotWriter &out, Block *blk) {
+  for (unsigned int i = 0; i < BLOCKSIZE; i++)
+    out.PutWord(blk->getWord(i));
+}
+
+HIDDEN void restoreBlock(SnapshotReader &in, Block *blk) {
+  for (unsigned int i = 0; i < BLOCKSIZE; i++)
+    blk->setWord(i, in.GetWord());
+}
+
+HIDDEN void restoreStatStr(SnapshotReader &in, char *buf, size_t size) {
+  std::string str = in.GetString();
+  snprintf(buf, size, "%s", str.c_str());
+}
@@ -25,114 +25,146 @@
  * scheduling of device events (such as device operations completion and
  * interrupts generation).  They are: Event class, to keep track of single
  * events, as required by devices; and EventQueue class, to organize the
- * Events into a time-ordered queue.
+ * Events into a time-ordered queue (a binary heap of pooled Events).
  *
  ***************************************************************************/
 
 #include "uriscv/event.h"
 
 #include <cassert>
-#include <stdio.h>
-#include <stdlib.h>
 
-#include "uriscv/const.h"
-#include "uriscv/time_stamp.h"
-#include "uriscv/utility.h"
-
-Event::Event(uint64_t ts, Word inc, Callback callback)
-    : deadline(ts + inc), callback(callback), next(NULL) {}
-
-// This method links an Event to its successor in a structure
-void Event::AddBefore(Event *ev) { next = ev; }
-
-// This method inserts an Event after another, linking the former to the
-// successor of the latter
-void Event::InsAfter(Event *ev) {
-  next = ev->next;
-  ev->next = this;
-}
-
-// This method returns the pointer to the successor of an Event
-Event *Event::Next() { return (next); }
+#include "uriscv/snapshot.h"
 
 // This method creates a new (empty) queue
-EventQueue::EventQueue() {
-  head = NULL;
-  lastIns = NULL;
-}
+EventQueue::EventQueue() : firstOrder(0), lastOrder(0), freeList(NULL) {}
 
 // This method deletes the queue and its associated structures
 EventQueue::~EventQueue() {
-  Event *p, *q;
-
-  p = head;
-  q = NULL;
-  while (p != NULL) {
-    q = p->Next();
-    delete p;
-    p = q;
-  }
+  for (Event *chunk : chunks)
+    delete[] chunk;
 }
 
 uint64_t EventQueue::nextDeadline() const {
   assert(!IsEmpty());
-  return head->getDeadline();
+  return heap.front()->deadline;
 }
 
-Event::Callback EventQueue::nextCallback() const {
+uint64_t EventQueue::InsertQ(uint64_t tod, Word delay, const EventTag &tag,
+                             const Event::Callback &callback) {
+  Event *ins = allocEvent();
+  ins->deadline = tod + delay;
+  ins->tag = tag;
+  ins->callback = callback;
+
+  // An event due no later than all the others goes before them, even
+  // those with the same deadline; any other one after them
+  if (IsEmpty() || ins->deadline <= heap.front()->deadline)
+    ins->order = --firstOrder;
+  else
+    ins->order = ++lastOrder;
+
+  heap.push_back(ins);
+  siftUp(heap.size() - 1);
+  return ins->deadline;
+}
+
+void EventQueue::RunHead() {
   assert(!IsEmpty());
-  return head->getCallback();
+
+  // The event leaves the queue before its callback runs, so that events
+  // scheduled by the latter are ordered against the remaining ones
+  Event *head = heap.front();
+  heap.front() = heap.back();
+  heap.pop_back();
+  if (!heap.empty())
+    siftDown(0);
+
+  head->callback();
+  freeEvent(head);
 }
 
-// This method creates a new Event object and inserts it in the
-// EventQueue; EventQueue is sorted on ascending time order
-
-uint64_t EventQueue::InsertQ(uint64_t tod, Word delay,
-                             Event::Callback callback) {
-  Event *ins, *p, *q;
-
-  ins = new Event(tod, delay, callback);
-  if (IsEmpty()) {
-    head = ins;
-  } else if (ins->getDeadline() <= head->getDeadline()) {
-    // "ins" has to happen before that at the head of the queue;
-    // should be put before it
-    ins->AddBefore(head);
-    head = ins;
-  } else {
-    // should find place in queue: check lastIns to shorten search time
-    if (lastIns != NULL && !(ins->getDeadline() <= lastIns->getDeadline()))
-      // can start from lastIns
-      p = lastIns;
-    else
-      // must start from the head
-      p = head;
-
-    q = p;
-    while (p != NULL && p->getDeadline() <= ins->getDeadline()) {
-      q = p;
-      p = p->Next();
-    }
-    // place found: insert after q and before p
-    ins->InsAfter(q);
+void EventQueue::Save(SnapshotWriter &out) const {
+  out.PutU64(firstOrder);
+  out.PutU64(lastOrder);
+  out.PutWord(heap.size());
+  for (const Event *ev : heap) {
+    out.PutU64(ev->deadline);
+    out.PutU64(ev->order);
+    out.PutWord(ev->tag.type);
+    for (Word a : ev->tag.arg)
+      out.PutWord(a);
   }
-  lastIns = ins;
-  return ins->getDeadline();
 }
 
-// This method removes the head of a (not empty) queue and sets it to the
-// following Event
-void EventQueue::RemoveHead() {
-  Event *p;
+void EventQueue::Restore(SnapshotReader &in,
+                         const CallbackMaker &makeCallback) {
+  for (Event *ev : heap)
+    freeEvent(ev);
+  heap.clear();
+
+  firstOrder = in.GetU64();
+  lastOrder = in.GetU64();
+  for (Word n = in.GetWord(); n > 0; n--) {
+    Event *ev = allocEvent();
+    ev->deadline = in.GetU64();
+    ev->order = in.GetU64();
+    ev->tag.type = in.GetWord();
+    for (Word &a : ev->tag.arg)
+      a = in.GetWord();
+    ev->callback = makeCallback(ev->tag);
+    heap.push_back(ev);
+    siftUp(heap.size() - 1);
+  }
+}
+
+// This method returns an unused Event, allocating a new chunk of them
+// if there are none left
+Event *EventQueue::allocEvent() {
+  if (freeList == NULL) {
+    Event *chunk = new Event[kChunkSize];
+    chunks.push_back(chunk);
+    for (unsigned int i = 0; i < kChunkSize; i++)
+      freeEvent(&chunk[i]);
+  }
+
+  Event *ev = freeList;
+  freeList = ev->next;
+  return ev;
+}
 
-  if (!IsEmpty()) {
-    p = head;
-    head = head->Next();
+// This method puts an Event back in the pool, dropping its callback
+// (and whatever the callback holds)
+void EventQueue::freeEvent(Event *ev) {
+  ev->callback.clear();
+  ev->next = freeList;
+  freeList = ev;
+}
 
-    if (p == lastIns)
-      // reposition lastIns to the new head
-      lastIns = head;
+void EventQueue::siftUp(size_t i) {
+  Event *ev = heap[i];
+  while (i > 0) {
+    size_t parent = (i - 1) / 2;
+    if (!before(ev, heap[parent]))
+      break;
+    heap[i] = heap[parent];
+    i = parent;
+  }
+  heap[i] = ev;
+}
 
-    delete p;
+void EventQueue::siftDown(size_t i) {
+  Event *ev = heap[i];
+  const size_t n = heap.size();
+  for (;;) {
+    size_t child = 2 * i + 1;
+    if (child >= n)
+      break;
+    if (child + 1 < n && before(heap[child + 1], heap[child]))
+      child++;
+    if (!before(heap[child], ev))
+      break;
+    heap[i] = heap[child];
+    i = child;
   }
+  heap[i] = ev;
 }
@@ -0,0 +1,131 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+
+/****************************************************************************
+ *
+ * This module implements the InputLog class, which records the inputs
+ * coming from outside the simulation to a text file and reads them back
+ * for replays.
+ *
+ ****************************************************************************/
+
+#include "uriscv/input_log.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "uriscv/error.h"
+#include "uriscv/machine_config.h"
+
+HIDDEN std::string escape(const std::string &text) {
+  std::string escaped;
+  for (unsigned char c : text) {
+    if (isprint(c) && c != '\\') {
+      escaped += c;
+    } else {
+      char buf[8];
+      sprintf(buf, "\\x%02x", c);
+      escaped += buf;
+    }
+  }
+  return escaped;
+}
+
+HIDDEN bool unescape(const std::string &escaped, std::string *text) {
+  text->clear();
+  for (size_t i = 0; i < escaped.size(); i++) {
+    if (escaped[i] != '\\') {
+      *text += escaped[i];
+    } else if (i + 3 < escaped.size() && escaped[i + 1] == 'x' &&
+               isxdigit(escaped[i + 2]) && isxdigit(escaped[i + 3])) {
+      *text += (char)strtoul(escaped.substr(i + 2, 2).c_str(), NULL, 16);
+      i += 3;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+InputLog::InputLog(const std::string &fileName) : fileName(fileName) {
+  if ((file = fopen(fileName.c_str(), "w")) == NULL)
+    throw FileError(fileName);
+  fputs("# uRISCV input log\n", file);
+}
+
+InputLog::~InputLog() { fclose(file); }
+
+void InputLog::Write(const ExternalInput &input) {
+  const std::string device =
+      MachineConfig::DeviceName(input.il, input.devNo);
+  int res;
+  if (input.type == ExternalInput::EI_TERMINAL)
+    res = fprintf(file, "%llu input %s %s\n", (unsigned long long)input.tick,
+                  device.c_str(), escape(input.text).c_str());
+  else
+    res = fprintf(file, "%llu condition %s %d\n",
+                  (unsigned long long)input.tick, device.c_str(),
+                  input.working ? 1 : 0);
+  if (res < 0 || fflush(file) != 0)
+    throw FileError(fileName);
+}
+
+std::vector<ExternalInput> InputLog::Read(const std::string &fileName) {
+  std::ifstream in(fileName.c_str());
+  if (in.fail())
+    throw FileError(fileName);
+
+  std::vector<ExternalInput> inputs;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+
+    std::istringstream fields(line);
+    ExternalInput input;
+    std::string kind, device;
+    bool valid = (fields >> input.tick >> kind >> device) &&
+                 MachineConfig::ParseDeviceName(device, &input.il,
+                                                &input.devNo);
+    if (valid && kind == "input") {
+      input.type = ExternalInput::EI_TERMINAL;
+      std::string escaped;
+      if (fields.get() == ' ')
+        std::getline(fields, escaped);
+      valid = unescape(escaped, &input.text);
+    } else if (valid && kind == "condition") {
+      input.type = ExternalInput::EI_CONDITION;
+      int working;
+      valid = (bool)(fields >> working);
+      input.working = working != 0;
+    } else {
+      valid = false;
+    }
+
+    // Replays rely on inputs being in tick order
+    if (!valid || (!inputs.empty() && input.tick < inputs.back().tick))
+      throw InvalidFileFormatError(fileName, "Invalid input log entry: " +
+                                                 line);
+    inputs.push_back(input);
+  }
+  return inputs;
+}
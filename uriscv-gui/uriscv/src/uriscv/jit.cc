@@ -0,0 +1,883 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the Jit class, which translates guest basic
+ * blocks into x86-64 host code run by Processor::ExecBlock().
+ *
+ * Translated code works directly on the processor register array
+ * (passed in rdi) and on a JitContext (passed in rsi), using eax, ecx
+ * and rdx as scratch registers. Each block starts by charging its length
+ * to the cycle budget, bailing out without running anything if the
+ * budget is not enough; block exits either return to the caller or, once
+ * the target block has been translated, jump straight to it.
+ *
+ * Loads and stores look the page up in the SystemBus page map, as
+ * DataRead() and DataWrite() do; when the page is not mapped (or, for
+ * stores, holds decoded code) the block bails out before the
+ * instruction, giving back the cycles it did not run, and the
+ * interpreter takes over. Since the JIT only translates pages some
+ * decode cache holds, a store checking the bus code page bitmap never
+ * writes to translated code.
+ *
+ * Instruction semantics follow the interpreter handlers exactly (shift
+ * amounts are taken modulo 32, SRA and SRAI behave as they do in
+ * Processor), so that the two can be checked against each other. LH is
+ * left to the interpreter, whose handler returns the whole word.
+ *
+ ****************************************************************************/
+
+#include "uriscv/jit.h"
+
+#include <cstddef>
+#include <cstring>
+#include <sys/mman.h>
+
+#include "uriscv/const.h"
+#include "uriscv/error.h"
+#include "uriscv/processor_defs.h"
+#include "uriscv/systembus.h"
+
+// x86-64 encodings used by translated code
+#define X86_EAX 0
+#define X86_ECX 1
+
+#define X86_CC_B 0x2
+#define X86_CC_AE 0x3
+#define X86_CC_E 0x4
+#define X86_CC_NE 0x5
+#define X86_CC_A 0x7
+#define X86_CC_L 0xC
+#define X86_CC_GE 0xD
+
+#define CTX_BUDGET offsetof(JitContext, budget)
+#define CTX_PC offsetof(JitContext, pc)
+#define CTX_LASTPC offsetof(JitContext, lastPC)
+#define CTX_READLIMIT offsetof(JitContext, readLimit)
+#define CTX_WRITELIMIT offsetof(JitContext, writeLimit)
+
+Jit::Jit(SystemBus *bus)
+    : bus(bus), code(NULL), cur(NULL),
+      jumpCache(new JumpEntry[kJumpCacheSize]),
+      codePages(new uint32_t[1U << 15]), hasCode(false) {
+  if (IsSupported()) {
+    void *p = mmap(NULL, kCodeSize, PROT_READ | PROT_EXEC,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED)
+      code = static_cast<uint8_t *>(p);
+  }
+  Flush();
+}
+
+Jit::~Jit() {
+  if (code != NULL)
+    munmap(code, kCodeSize);
+}
+
+bool Jit::IsSupported() {
+#if defined(__x86_64__)
+  return true;
+#else
+  return false;
+#endif
+}
+
+JitCode Jit::Lookup(Word vaddr, Word paddr) {
+  if (code == NULL)
+    return NULL;
+
+  // Make room for a new block before looking it up, since flushing
+  // empties the block map
+  if ((size_t)(cur - code) + kMaxBlockSize > kCodeSize)
+    Flush();
+
+  uint64_t key = blockKey(vaddr, paddr);
+  Block &block = blocks[key];
+  if (block.code == NULL && block.hits < kHotThreshold &&
+      ++block.hits == kHotThreshold && !writtenOften(paddr) &&
+      setWritable(true)) {
+    block.code = translate(vaddr, paddr);
+    if (block.code != NULL) {
+      // Chain the exits that were waiting for this block
+      std::pair<ChainMap::iterator, ChainMap::iterator> r =
+          pendingChains.equal_range(key);
+      for (ChainMap::iterator it = r.first; it != r.second; ++it) {
+        uint8_t *stub = it->second;
+        int32_t rel = (int32_t)((uint8_t *)block.code - (stub + 5));
+        stub[0] = 0xE9;
+        std::memcpy(stub + 1, &rel, sizeof(rel));
+      }
+      pendingChains.erase(r.first, r.second);
+    }
+    if (!setWritable(false))
+      Panic("Cannot make translated code executable");
+  }
+
+  if (block.code != NULL) {
+    JumpEntry &e = jumpCache[(vaddr >> 2) & (kJumpCacheSize - 1)];
+    e.paddr = paddr;
+    e.vaddr = vaddr;
+    e.code = block.code;
+  }
+
+  return block.code;
+}
+
+void Jit::Flush() {
+  blocks.clear();
+  pendingChains.clear();
+  cur = code;
+  std::memset(codePages.get(), 0, (1U << 15) * sizeof(uint32_t));
+  hasCode = false;
+
+  // No block starts at a misaligned address
+  for (unsigned int i = 0; i < kJumpCacheSize; i++) {
+    jumpCache[i].paddr = MAXWORDVAL;
+    jumpCache[i].vaddr = MAXWORDVAL;
+    jumpCache[i].code = NULL;
+  }
+}
+
+// This method tells whether the code translated from the page containing
+// paddr was discarded too many times to translate it again
+bool Jit::writtenOften(Word paddr) const {
+  std::unordered_map<Word, unsigned int>::const_iterator it =
+      pageWrites.find(paddr >> 12);
+  return it != pageWrites.end() && it->second >= kMaxPageWrites;
+}
+
+// This method makes the code buffer either writable or executable (it is
+// never both); it returns false if the protection cannot be changed
+bool Jit::setWritable(bool writable) {
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+  return mprotect(code, kCodeSize, prot) == 0;
+}
+
+// This method translates the block starting at vaddr (paddr), which ends
+// at the first conditional branch, JAL or JALR, before the first
+// instruction that cannot be translated, or at the end of the page
+JitCode Jit::translate(Word vaddr, Word paddr) {
+  uint8_t *start = cur;
+  bailJumps.clear();
+
+  // cmp dword [rsi+budget], n; jb bail; sub dword [rsi+budget], n
+  emitByte(0x81);
+  emitByte(0x7E);
+  emitByte(CTX_BUDGET);
+  uint8_t *cmpLength = cur;
+  emitWord(0);
+  emitByte(0x0F);
+  emitByte(0x80 | X86_CC_B);
+  uint8_t *bailRel = cur;
+  emitWord(0);
+  emitByte(0x81);
+  emitByte(0x6E);
+  emitByte(CTX_BUDGET);
+  uint8_t *subLength = cur;
+  emitWord(0);
+
+  unsigned int n = 0;
+  bool branch = false;
+  while (n < kMaxBlockLength && !branch) {
+    Word pc = vaddr + n * WORDLEN;
+    Word pa = paddr + n * WORDLEN;
+    Word instr;
+    if (VPN(pa) != VPN(paddr) || bus->InstrReadGDB(pa, &instr, NULL))
+      break;
+
+    if ((OPCODE(instr) == B_TYPE && FUNC3(instr) != 0x2 &&
+         FUNC3(instr) != 0x3) ||
+        OPCODE(instr) == OP_JAL || OPCODE(instr) == OP_JALR) {
+      emitBranch(instr, pc, vaddr, paddr);
+      branch = true;
+    } else if (!translateInstr(instr, pc)) {
+      break;
+    }
+    n++;
+  }
+
+  if (n == 0) {
+    cur = start;
+    return NULL;
+  }
+
+  if (!branch) {
+    // mov dword [rsi+lastPC], pc
+    emitByte(0xC7);
+    emitByte(0x46);
+    emitByte(CTX_LASTPC);
+    emitWord(vaddr + (n - 1) * WORDLEN);
+    emitExit(vaddr + n * WORDLEN, vaddr, paddr);
+  }
+
+  // bail: mov dword [rsi+pc], vaddr; ret
+  int32_t rel = (int32_t)(cur - (bailRel + 4));
+  std::memcpy(bailRel, &rel, sizeof(rel));
+  emitByte(0xC7);
+  emitByte(0x46);
+  emitByte(CTX_PC);
+  emitWord(vaddr);
+  emitByte(0xC3);
+
+  // The bail jumps of each instruction land on code giving back the
+  // cycles of the instructions not run: mov dword [rsi+pc], pc;
+  // mov dword [rsi+lastPC], pc - 4; add dword [rsi+budget], n - i; ret
+  uint8_t *bail = NULL;
+  for (size_t j = 0; j < bailJumps.size(); j++) {
+    const BailJump &b = bailJumps[j];
+    if (j == 0 || b.pc != bailJumps[j - 1].pc) {
+      unsigned int i = (b.pc - vaddr) / WORDLEN;
+      bail = cur;
+      emitByte(0xC7);
+      emitByte(0x46);
+      emitByte(CTX_PC);
+      emitWord(b.pc);
+      if (i > 0) {
+        emitByte(0xC7);
+        emitByte(0x46);
+        emitByte(CTX_LASTPC);
+        emitWord(b.pc - WORDLEN);
+      }
+      emitByte(0x81);
+      emitByte(0x46);
+      emitByte(CTX_BUDGET);
+      emitWord(n - i);
+      emitByte(0xC3);
+    }
+    rel = (int32_t)(bail - (b.rel + 4));
+    std::memcpy(b.rel, &rel, sizeof(rel));
+  }
+
+  std::memcpy(cmpLength, &n, sizeof(n));
+  std::memcpy(subLength, &n, sizeof(n));
+
+  Word pfn = paddr >> 12;
+  codePages[pfn >> 5] |= 1U << (pfn & 31);
+  hasCode = true;
+
+  return reinterpret_cast<JitCode>(start);
+}
+
+// This method emits the code for a computational instruction; it returns
+// false (emitting nothing) if instr cannot be translated
+bool Jit::translateInstr(Word instr, Word pc) {
+  unsigned int rd = RD(instr);
+  unsigned int rs1 = RS1(instr);
+  unsigned int rs2 = RS2(instr);
+
+  switch (OPCODE(instr)) {
+  case R_TYPE: {
+    uint8_t op;
+    switch (FUNC3(instr)) {
+    case OP_ADD_FUNC3:
+      if (FUNC7(instr) == OP_ADD_FUNC7)
+        op = 0x01;
+      else if (FUNC7(instr) == OP_SUB_FUNC7)
+        op = 0x29;
+      else if (FUNC7(instr) == OP_MUL_FUNC7)
+        op = 0xAF;
+      else
+        return false;
+      break;
+    case OP_SLL_FUNC3:
+      if (FUNC7(instr) != OP_SLL_FUNC7)
+        return false;
+      op = 0xE0;
+      break;
+    case OP_SLT_FUNC3:
+      if (FUNC7(instr) != OP_SLT_FUNC7)
+        return false;
+      op = X86_CC_L;
+      break;
+    case OP_SLTU_FUNC3:
+      if (FUNC7(instr) != OP_SLTU_FUNC7)
+        return false;
+      op = X86_CC_B;
+      break;
+    case OP_XOR_FUNC3:
+      if (FUNC7(instr) != OP_XOR_FUNC7)
+        return false;
+      op = 0x31;
+      break;
+    case OP_SRL_FUNC3:
+      if (FUNC7(instr) == OP_SRA_FUNC7)
+        op = 0xF8;
+      else if (FUNC7(instr) == OP_SRL_FUNC7)
+        op = 0xE8;
+      else
+        return false;
+      break;
+    case OP_OR_FUNC3:
+      if (FUNC7(instr) != OP_OR_FUNC7)
+        return false;
+      op = 0x09;
+      break;
+    case OP_AND_FUNC3:
+      if (FUNC7(instr) != OP_AND_FUNC7)
+        return false;
+      op = 0x21;
+      break;
+    default:
+      return false;
+    }
+
+    if (rd == 0)
+      return true;
+
+    emitLoad(X86_EAX, rs1);
+    emitLoad(X86_ECX, rs2);
+    switch (FUNC3(instr)) {
+    case OP_SLL_FUNC3:
+    case OP_SRL_FUNC3:
+      // shl/shr eax, cl
+      emitByte(0xD3);
+      emitByte(op == 0xF8 ? 0xE8 : op);
+      break;
+    case OP_SLT_FUNC3:
+    case OP_SLTU_FUNC3:
+      // cmp eax, ecx
+      emitByte(0x39);
+      emitByte(0xC8);
+      emitSetCC(op);
+      break;
+    default:
+      if (op == 0xAF) {
+        // imul eax, ecx
+        emitByte(0x0F);
+        emitByte(0xAF);
+        emitByte(0xC1);
+      } else {
+        emitByte(op);
+        emitByte(0xC8);
+      }
+      break;
+    }
+    emitStore(rd);
+
+    if (op == 0xF8) {
+      // SRA: the shift result is overwritten by rs1 ^ rs2, read again
+      emitLoad(X86_EAX, rs1);
+      emitLoad(X86_ECX, rs2);
+      emitByte(0x31);
+      emitByte(0xC8);
+      emitStore(rd);
+    }
+    return true;
+  }
+
+  case I_TYPE: {
+    SWord imm = I_IMM(instr);
+    uint8_t op;
+    switch (FUNC3(instr)) {
+    case OP_ADDI:
+      op = 0x05;
+      break;
+    case OP_SLLI:
+      op = 0xE0;
+      break;
+    case OP_SLTI:
+      op = X86_CC_L;
+      break;
+    case OP_SLTIU:
+      op = X86_CC_B;
+      break;
+    case OP_XORI:
+      op = 0x35;
+      break;
+    case OP_SR:
+      if (FUNC7(instr) != OP_SRLI_FUNC7 && FUNC7(instr) != OP_SRAI_FUNC7)
+        return false;
+      op = 0xE8;
+      break;
+    case OP_ORI:
+      op = 0x0D;
+      break;
+    case OP_ANDI:
+      op = 0x25;
+      break;
+    default:
+      return false;
+    }
+
+    if (rd == 0)
+      return true;
+
+    emitLoad(X86_EAX, rs1);
+    if (op == 0xE0 || op == 0xE8) {
+      // shl/shr eax, imm8 (shift amounts are used raw)
+      emitByte(0xC1);
+      emitByte(op);
+      emitByte(imm & 0x1F);
+    } else {
+      imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+      if (op == X86_CC_L || op == X86_CC_B) {
+        // cmp eax, imm32
+        emitByte(0x3D);
+        emitWord(imm);
+        emitSetCC(op);
+      } else {
+        emitByte(op);
+        emitWord(imm);
+      }
+    }
+    emitStore(rd);
+    return true;
+  }
+
+  case OP_LUI: {
+    if (rd != 0) {
+      // mov eax, imm32
+      emitByte(0xB8);
+      emitWord(SIGN_EXTENSION(U_IMM(instr), U_IMM_SIZE) << 12);
+      emitStore(rd);
+    }
+    return true;
+  }
+
+  case OP_L:
+    if (FUNC3(instr) != OP_LB && FUNC3(instr) != OP_LW &&
+        FUNC3(instr) != OP_LBU && FUNC3(instr) != OP_LHU)
+      return false;
+    emitMemAccess(instr, pc);
+    return true;
+
+  case S_TYPE:
+    if (FUNC3(instr) != OP_SB && FUNC3(instr) != OP_SH &&
+        FUNC3(instr) != OP_SW)
+      return false;
+    emitMemAccess(instr, pc);
+    return true;
+
+  case OP_AUIPC: {
+    if (rd != 0) {
+      SWord imm = U_IMM(instr);
+      imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+      emitByte(0xB8);
+      emitWord((SWord)pc + imm);
+      emitStore(rd);
+    }
+    return true;
+  }
+
+  default:
+    return false;
+  }
+}
+
+// This method emits the code for the load or store at pc, which bails
+// out to the interpreter unless the word accessed is in a page mapped
+// for direct access (see SystemBus::DataRead() and DataWrite())
+void Jit::emitMemAccess(Word instr, Word pc) {
+  const bool store = (OPCODE(instr) == S_TYPE);
+  const unsigned int func3 = FUNC3(instr);
+  int16_t imm;
+  if (store) {
+    imm = S_IMM(instr);
+    imm = SIGN_EXTENSION(imm, S_IMM_SIZE);
+  } else {
+    imm = I_IMM(instr);
+    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+  }
+
+  // mov eax, rs1; add eax, imm32
+  emitLoad(X86_EAX, RS1(instr));
+  emitByte(0x05);
+  emitWord((SWord)imm);
+
+  if ((store && func3 == OP_SW) || (!store && func3 == OP_LW)) {
+    // test al, 3; jnz bail
+    emitByte(0xA8);
+    emitByte(ALIGNMASK);
+    emitBail(X86_CC_NE, pc);
+  }
+
+  // cmp eax, [rsi+limit]; jae bail
+  emitByte(0x3B);
+  emitByte(0x46);
+  emitByte(store ? CTX_WRITELIMIT : CTX_READLIMIT);
+  emitBail(X86_CC_AE, pc);
+
+  if (store) {
+    // mov ecx, eax; shr ecx, 12; mov rdx, codePages; bt [rdx], ecx;
+    // jc bail
+    emitByte(0x89);
+    emitByte(0xC1);
+    emitByte(0xC1);
+    emitByte(0xE9);
+    emitByte(SystemBus::kPageShift);
+    emitByte(0x48);
+    emitByte(0xBA);
+    emitPointer(bus->codePages.get());
+    emitByte(0x0F);
+    emitByte(0xA3);
+    emitByte(0x0A);
+    emitBail(X86_CC_B, pc);
+    emitPageLookup(bus->writeDir, pc);
+  } else {
+    emitPageLookup(bus->readDir, pc);
+  }
+
+  // and eax, offset mask (halfwords are aligned as the interpreter does)
+  const bool half = (store && func3 == OP_SH) || (!store && func3 == OP_LHU);
+  emitByte(0x25);
+  emitWord((Word)(half ? ~VPNMASK & ~1UL : ~VPNMASK));
+
+  if (store) {
+    emitLoad(X86_ECX, RS2(instr));
+    switch (func3) {
+    case OP_SB:
+      // mov [rdx+rax], cl
+      emitByte(0x88);
+      break;
+    case OP_SH:
+      // mov [rdx+rax], cx
+      emitByte(0x66);
+      emitByte(0x89);
+      break;
+    default:
+      // mov [rdx+rax], ecx
+      emitByte(0x89);
+      break;
+    }
+    emitByte(0x0C);
+    emitByte(0x02);
+    return;
+  }
+
+  switch (func3) {
+  case OP_LB:
+    // movsx eax, byte [rdx+rax]
+    emitByte(0x0F);
+    emitByte(0xBE);
+    break;
+  case OP_LBU:
+    // movzx eax, byte [rdx+rax]
+    emitByte(0x0F);
+    emitByte(0xB6);
+    break;
+  case OP_LHU:
+    // movzx eax, word [rdx+rax]
+    emitByte(0x0F);
+    emitByte(0xB7);
+    break;
+  default:
+    // mov eax, [rdx+rax]
+    emitByte(0x8B);
+    break;
+  }
+  emitByte(0x04);
+  emitByte(0x02);
+  emitStore(RD(instr));
+}
+
+// This method emits the code for the conditional branch, JAL or JALR at
+// pc, which ends the block
+void Jit::emitBranch(Word instr, Word pc, Word vaddr, Word paddr) {
+  // mov dword [rsi+lastPC], pc
+  emitByte(0xC7);
+  emitByte(0x46);
+  emitByte(CTX_LASTPC);
+  emitWord(pc);
+
+  if (OPCODE(instr) == OP_JALR) {
+    // mov eax, rs1; add eax, imm32; and eax, ~1 (before rd is written,
+    // since it may be rs1)
+    unsigned int rd = RD(instr);
+    emitLoad(X86_EAX, RS1(instr));
+    emitByte(0x05);
+    emitWord(SIGN_EXTENSION(I_IMM(instr), I_IMM_SIZE));
+    emitByte(0x83);
+    emitByte(0xE0);
+    emitByte(0xFE);
+    if (rd != 0) {
+      // mov ecx, pc + 4; mov [rdi+4*rd], ecx
+      emitByte(0xB9);
+      emitWord(pc + WORDLEN);
+      emitByte(0x89);
+      emitByte(0x4F);
+      emitByte(rd * WORDLEN);
+    }
+    emitJump(vaddr, paddr);
+    return;
+  }
+
+  if (OPCODE(instr) == OP_JAL) {
+    unsigned int rd = RD(instr);
+    Word imm = SIGN_EXTENSION(J_IMM(instr), J_IMM_SIZE) & 0xfffffffe;
+    if (rd != 0) {
+      emitByte(0xB8);
+      emitWord(pc + WORDLEN);
+      emitStore(rd);
+    }
+    emitExit(pc + imm, vaddr, paddr);
+    return;
+  }
+
+  int16_t imm = B_IMM(instr);
+  imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+
+  uint8_t cc;
+  switch (FUNC3(instr)) {
+  case OP_BEQ:
+    cc = X86_CC_E;
+    break;
+  case OP_BNE:
+    cc = X86_CC_NE;
+    break;
+  case OP_BLT:
+    cc = X86_CC_L;
+    break;
+  case OP_BGE:
+    cc = X86_CC_GE;
+    break;
+  case OP_BLTU:
+    cc = X86_CC_B;
+    break;
+  default:
+    cc = X86_CC_AE;
+    break;
+  }
+
+  // cmp eax, ecx; jcc taken
+  emitLoad(X86_EAX, RS1(instr));
+  emitLoad(X86_ECX, RS2(instr));
+  emitByte(0x39);
+  emitByte(0xC8);
+  emitByte(0x0F);
+  emitByte(0x80 | cc);
+  uint8_t *takenRel = cur;
+  emitWord(0);
+
+  emitExit(pc + WORDLEN, vaddr, paddr);
+
+  int32_t rel = (int32_t)(cur - (takenRel + 4));
+  std::memcpy(takenRel, &rel, sizeof(rel));
+  emitExit(pc + (SWord)imm, vaddr, paddr);
+}
+
+// This method emits a block exit to the address in eax: a jump to its
+// block if it is in the same page and found in the jump cache, a return
+// otherwise
+void Jit::emitJump(Word vaddr, Word paddr) {
+  static_assert(sizeof(JumpEntry) == 16, "jump cache entries are 16 bytes");
+  uint8_t *exitRel[4];
+
+  // test al, 3; jnz exit
+  emitByte(0xA8);
+  emitByte(ALIGNMASK);
+  emitByte(0x0F);
+  emitByte(0x80 | X86_CC_NE);
+  exitRel[0] = cur;
+  emitWord(0);
+
+  // mov ecx, eax; xor ecx, vaddr; cmp ecx, page offset mask; ja exit
+  emitByte(0x89);
+  emitByte(0xC1);
+  emitByte(0x81);
+  emitByte(0xF1);
+  emitWord(vaddr);
+  emitByte(0x81);
+  emitByte(0xF9);
+  emitWord((Word)~VPNMASK);
+  emitByte(0x0F);
+  emitByte(0x80 | X86_CC_A);
+  exitRel[1] = cur;
+  emitWord(0);
+
+  // mov ecx, eax; shr ecx, 2; and ecx, size - 1; shl ecx, 4;
+  // mov rdx, jumpCache; add rdx, rcx
+  emitByte(0x89);
+  emitByte(0xC1);
+  emitByte(0xC1);
+  emitByte(0xE9);
+  emitByte(2);
+  emitByte(0x81);
+  emitByte(0xE1);
+  emitWord(kJumpCacheSize - 1);
+  emitByte(0xC1);
+  emitByte(0xE1);
+  emitByte(4);
+  emitByte(0x48);
+  emitByte(0xBA);
+  emitPointer(jumpCache.get());
+  emitByte(0x48);
+  emitByte(0x01);
+  emitByte(0xCA);
+
+  // mov ecx, eax; and ecx, page offset mask; or ecx, page; cmp ecx,
+  // [rdx+paddr]; jne exit; cmp eax, [rdx+vaddr]; jne exit
+  emitByte(0x89);
+  emitByte(0xC1);
+  emitByte(0x81);
+  emitByte(0xE1);
+  emitWord((Word)~VPNMASK);
+  emitByte(0x81);
+  emitByte(0xC9);
+  emitWord(VPN(paddr));
+  emitByte(0x3B);
+  emitByte(0x4A);
+  emitByte(offsetof(JumpEntry, paddr));
+  emitByte(0x0F);
+  emitByte(0x80 | X86_CC_NE);
+  exitRel[2] = cur;
+  emitWord(0);
+  emitByte(0x3B);
+  emitByte(0x42);
+  emitByte(offsetof(JumpEntry, vaddr));
+  emitByte(0x0F);
+  emitByte(0x80 | X86_CC_NE);
+  exitRel[3] = cur;
+  emitWord(0);
+
+  // jmp [rdx+code]
+  emitByte(0xFF);
+  emitByte(0x62);
+  emitByte(offsetof(JumpEntry, code));
+
+  // exit: mov dword [rsi+pc], eax; ret
+  for (unsigned int i = 0; i < 4; i++) {
+    int32_t rel = (int32_t)(cur - (exitRel[i] + 4));
+    std::memcpy(exitRel[i], &rel, sizeof(rel));
+  }
+  emitByte(0x89);
+  emitByte(0x46);
+  emitByte(CTX_PC);
+  emitByte(0xC3);
+}
+
+// This method emits a block exit to target: a jump to its block if it
+// is already translated, a return otherwise (to be patched into a jump
+// as soon as the target gets translated, if it is in the same page)
+void Jit::emitExit(Word target, Word vaddr, Word paddr) {
+  if (VPN(target) == VPN(vaddr) && !BADADDR(target)) {
+    Word tpaddr = VPN(paddr) | (target & ~VPNMASK);
+    uint64_t key = blockKey(target, tpaddr);
+    BlockMap::const_iterator it = blocks.find(key);
+    if (it != blocks.end() && it->second.code != NULL) {
+      // jmp rel32
+      emitByte(0xE9);
+      emitWord((Word)((uint8_t *)it->second.code - (cur + 4)));
+      return;
+    }
+    pendingChains.insert(std::make_pair(key, cur));
+  }
+
+  // mov dword [rsi+pc], target; ret
+  emitByte(0xC7);
+  emitByte(0x46);
+  emitByte(CTX_PC);
+  emitWord(target);
+  emitByte(0xC3);
+}
+
+void Jit::emitWord(Word w) {
+  std::memcpy(cur, &w, sizeof(w));
+  cur += sizeof(w);
+}
+
+void Jit::emitPointer(const void *p) {
+  std::memcpy(cur, &p, sizeof(p));
+  cur += sizeof(p);
+}
+
+// This method emits a load of guest register reg into host register
+// hostReg (eax or ecx)
+void Jit::emitLoad(unsigned int hostReg, unsigned int reg) {
+  if (reg == 0) {
+    // xor r32, r32
+    emitByte(0x31);
+    emitByte(0xC0 | (hostReg << 3) | hostReg);
+  } else {
+    // mov r32, [rdi+4*reg]
+    emitByte(0x8B);
+    emitByte(0x47 | (hostReg << 3));
+    emitByte(reg * WORDLEN);
+  }
+}
+
+// This method emits a store of eax into guest register reg
+void Jit::emitStore(unsigned int reg) {
+  if (reg != 0) {
+    // mov [rdi+4*reg], eax
+    emitByte(0x89);
+    emitByte(0x47);
+    emitByte(reg * WORDLEN);
+  }
+}
+
+// This method emits setcc al; movzx eax, al
+void Jit::emitSetCC(uint8_t cc) {
+  emitByte(0x0F);
+  emitByte(0x90 | cc);
+  emitByte(0xC0);
+  emitByte(0x0F);
+  emitByte(0xB6);
+  emitByte(0xC0);
+}
+
+// This method emits jcc bail, a jump to the code handing the instruction
+// at pc back to the interpreter (see translate())
+void Jit::emitBail(uint8_t cc, Word pc) {
+  emitByte(0x0F);
+  emitByte(0x80 | cc);
+  BailJump b = {pc, cur};
+  bailJumps.push_back(b);
+  emitWord(0);
+}
+
+// This method emits the lookup in the page map dir (the read or write
+// map of SystemBus) of the page containing the address in eax, leaving
+// it in rdx; the instruction at pc bails out if the page is not mapped
+void Jit::emitPageLookup(const void *dir, Word pc) {
+  // mov ecx, eax; shr ecx, 22; mov rdx, dir; mov rdx, [rdx+8*rcx]
+  emitByte(0x89);
+  emitByte(0xC1);
+  emitByte(0xC1);
+  emitByte(0xE9);
+  emitByte(SystemBus::kTableShift);
+  emitByte(0x48);
+  emitByte(0xBA);
+  emitPointer(dir);
+  emitByte(0x48);
+  emitByte(0x8B);
+  emitByte(0x14);
+  emitByte(0xCA);
+
+  // mov ecx, eax; shr ecx, 12; and ecx, table size - 1;
+  // mov rdx, [rdx+8*rcx]
+  emitByte(0x89);
+  emitByte(0xC1);
+  emitByte(0xC1);
+  emitByte(0xE9);
+  emitByte(SystemBus::kPageShift);
+  emitByte(0x81);
+  emitByte(0xE1);
+  emitWord(SystemBus::kTableSize - 1);
+  emitByte(0x48);
+  emitByte(0x8B);
+  emitByte(0x14);
+  emitByte(0xCA);
+
+  // test rdx, rdx; jz bail
+  emitByte(0x48);
+  emitByte(0x85);
+  emitByte(0xD2);
+  emitBail(X86_CC_E, pc);
+}
@@ -21,18 +21,24 @@
 
 #include "uriscv/machine.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <memory>
 
 #include "base/lang.h"
 
 #include "uriscv/const.h"
+#include "uriscv/error.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/processor.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/stoppoint.h"
 #include "uriscv/symbol_table.h"
 #include "uriscv/systembus.h"
 #include "uriscv/types.h"
+#include "uriscv/utility.h"
+#include "uriscv/worker_pool.h"
 
 Machine::Machine(const MachineConfig *config, StoppointSet *breakpoints,
                  StoppointSet *suspects, StoppointSet *tracepoints)
@@ -53,31 +59,204 @@ Machine::Machine(const MachineConfig *config, StoppointSet *breakpoints,
   }
 
   cpus[0]->Reset(MCTL_DEFAULT_BOOT_PC, MCTL_DEFAULT_BOOT_SP);
+
+  // Bus accesses to pages holding physical stoppoints must not bypass
+  // HandleBusAccess(): keep the bus page map up to date with them
+  StoppointSet *sets[] = {breakpoints, suspects, tracepoints};
+  for (StoppointSet *set : sets) {
+    if (set == NULL)
+      continue;
+    RegisterSigc(set->SignalStoppointInserted.connect(
+        sigc::mem_fun(this, &Machine::onStoppointsChanged)));
+    RegisterSigc(set->SignalStoppointRemoved.connect(
+        sigc::hide(sigc::mem_fun(this, &Machine::onStoppointsChanged))));
+  }
+  updatePageMap();
 }
 
 Machine::~Machine() {
+  if (checkpointThread.joinable())
+    checkpointThread.join();
+  workers.reset();
   for (Processor *p : cpus)
     delete p;
 }
 
-void Machine::step(unsigned int steps, unsigned int *stepped, bool *stopped) {
+// This method runs the machine for up to budget clock ticks, and
+// returns the number of ticks actually run; it returns early when the
+// machine halts, a processor goes idle or a stop is requested (by a
+// stoppoint or an exception), right after the cycle that caused it.
+// Time is run in quanta ending before the next bus event (device
+// operation completion or interval timer underflow): a single active
+// processor runs whole quanta in blocks, without any bus activity in
+// between (see Processor::ExecBlock()), and ends them early on a stop;
+// otherwise all processors are stepped one clock tick at a time, as any
+// of them may schedule a new event or stop the machine at any time.
+// With PARALLEL set, several active processors run whole quanta on
+// host threads of their own instead (see runParallel()), as long as no
+// instrumentation is needed; stops then take effect at the end of the
+// quantum, and the interleaving of the processors' memory accesses
+// depends on the host, so runs are no longer reproducible
+uint32_t Machine::run(uint32_t budget, bool *stopped) {
   stopRequested = pauseRequested = false;
   for (Processor *cpu : cpus)
     pd[cpu->Id()].stopCause = 0;
 
-  unsigned int i;
-  for (i = 0; !halted && i < steps && !stopRequested && !pauseRequested; ++i) {
-    bus->ClockTick();
-    for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
-      (*it)->Cycle();
+  if (pageMapStale)
+    updatePageMap();
+
+  // Only include in the execution loop the instrumentation that is
+  // actually needed
+  unsigned int features = 0;
+  if (DISASS)
+    features |= Processor::EF_TRACE;
+  if (stoppointsActive())
+    features |= Processor::EF_WATCH;
+  for (Processor *cpu : cpus)
+    cpu->setExecFeatures(features);
+
+  const bool parallel = PARALLEL && cpus.size() > 1 && features == 0 &&
+                        (tracepoints == NULL || tracepoints->IsEmpty());
+
+  uint32_t done = 0;
+  while (!halted && done < budget && !stopRequested && !pauseRequested) {
+    uint32_t n = 0;
+    Processor *cpu = blockProcessor();
+    if (cpu != NULL) {
+      n = cpu->ExecBlock(std::min(budget - done, bus->IdleCycles()));
+    } else if (parallel) {
+      n = std::min(std::min(budget - done, bus->IdleCycles()), kMaxQuantum);
+      if (n > 0)
+        runParallel(n);
+    }
+    if (n == 0) {
+      bus->ClockTick();
+      for (CpuVector::iterator it = cpus.begin(); it != cpus.end(); ++it)
+        (*it)->Cycle();
+      n = 1;
+    }
+    done += n;
   }
-  if (stepped)
-    *stepped = i;
+
   if (stopped)
     *stopped = stopRequested;
+  return done;
 }
 
-void Machine::step(bool *stopped) { step(1, NULL, stopped); }
+void Machine::step(bool *stopped) { run(1, stopped); }
+
+// This method runs all processors for quantum clock ticks (no more than
+// the bus can skip), each one on a host thread of its own, and then
+// brings the bus clock up to them.
+// Processors run in parallel only as long as they access RAM without
+// code in it (see SystemBus::ParallelSafe()) and do not need Cycle();
+// each one that stops early then runs the rest of its quantum serially,
+// when device registers and code may be written as usual. Events
+// scheduled or interrupts raised by processors in the quantum are only
+// seen by the bus and the other processors afterwards, and device
+// registers read the bus clock as of the beginning of the quantum
+void Machine::runParallel(uint32_t quantum) {
+  if (!workers)
+    workers.reset(new WorkerPool(cpus.size()));
+
+  uint32_t ran[MachineConfig::MAX_CPUS];
+  bus->setParallel(true);
+  workers->Run([this, quantum, &ran](unsigned int i) {
+    ran[i] = cpus[i]->RunQuantum(quantum, true);
+  });
+  bus->setParallel(false);
+
+  for (Processor *cpu : cpus)
+    if (ran[cpu->Id()] < quantum)
+      cpu->RunQuantum(quantum - ran[cpu->Id()], false);
+  for (Processor *cpu : cpus)
+    cpu->EndQuantum();
+
+  // Processors may have scheduled events in the meantime: they are
+  // handled late, but must not be skipped
+  for (uint32_t left = quantum; left > 0;) {
+    uint32_t n = std::min(left, bus->IdleCycles());
+    if (n > 0) {
+      bus->Skip(n);
+    } else {
+      bus->ClockTick();
+      n = 1;
+    }
+    left -= n;
+  }
+}
+
+// This method returns the processor that may run instructions in blocks
+// (see Processor::ExecBlock()), or NULL if the machine has to be stepped
+// one clock tick at a time: that is the case when more than one
+// processor is active, or when tracepoints are set. Breakpoints and
+// suspects are checked by blocks run with EF_WATCH, which end as soon
+// as one of them requests a stop
+Processor *Machine::blockProcessor() const {
+  if (tracepoints != NULL && !tracepoints->IsEmpty())
+    return NULL;
+
+  Processor *active = NULL;
+  for (Processor *cpu : cpus) {
+    if (!cpu->isHalted()) {
+      if (active != NULL)
+        return NULL;
+      active = cpu;
+    }
+  }
+
+  return active;
+}
+
+// This method tells whether processors have to notify virtual address
+// accesses (see HandleVMAccess()), i.e. whether breakpoints or suspects
+// may stop the machine
+bool Machine::stoppointsActive() const {
+  return (stopMask & SC_BREAKPOINT && breakpoints != NULL &&
+          !breakpoints->IsEmpty()) ||
+         (stopMask & SC_SUSPECT && suspects != NULL && !suspects->IsEmpty());
+}
+
+bool Machine::BreakpointsOnPage(Word asid, Word vaddr, Word paddr) const {
+  return stopMask & SC_BREAKPOINT && breakpoints != NULL &&
+         (breakpoints->MayCoverPage(asid, vaddr) ||
+          breakpoints->MayCoverPage(MAXASID, paddr));
+}
+
+bool Machine::SuspectsActive() const {
+  return stopMask & SC_SUSPECT && suspects != NULL && !suspects->IsEmpty();
+}
+
+void Machine::onStoppointsChanged() { pageMapStale = true; }
+
+// This method rebuilds the bus page map, leaving out the pages covered by
+// physical (MAXASID) stoppoints, and tells the bus whether its clock
+// registers are watched by suspects or tracepoints (see
+// SystemBus::setClockWatched()); disabled stoppoints and the stop mask
+// are not taken into account, since that only costs some speed
+void Machine::updatePageMap() {
+  const AddressRange clockRegs(MAXASID, BUS_REG_TOD_HI,
+                               BUS_REG_TIMER + WORDLEN - 1);
+  bool clockWatched = false;
+
+  bus->MapPages();
+
+  StoppointSet *sets[] = {breakpoints, suspects, tracepoints};
+  for (StoppointSet *set : sets) {
+    if (set == NULL)
+      continue;
+    for (const Stoppoint::Ptr &p : *set) {
+      const AddressRange &range = p->getRange();
+      if (range.getASID() == MAXASID)
+        bus->UnmapPages(range.getStart(), range.getEnd());
+      if (set != breakpoints && range.Overlaps(clockRegs))
+        clockWatched = true;
+    }
+  }
+
+  bus->setClockWatched(clockWatched);
+  pageMapStale = false;
+}
 
 uint32_t Machine::idleCycles() const {
   uint32_t c;
@@ -94,15 +273,94 @@ uint32_t Machine::idleCycles() const {
   return c;
 }
 
-void Machine::skip(uint32_t cycles) {
-  bus->Skip(cycles);
-  for (Processor *cpu : cpus) {
-    if (!cpu->isHalted())
-      cpu->Skip(cycles);
+void Machine::skip(uint32_t cycles) { bus->Skip(cycles); }
+
+void Machine::Halt() { halted = true; }
+
+// A snapshot holds the state of the bus (with memory, devices and
+// pending events) followed by that of each processor; breakpoints and
+// the other debugging settings are not part of it
+void Machine::Save(const std::string &fileName) const {
+  SnapshotWriter out(fileName);
+  saveState(out, "");
+  out.Close();
+}
+
+void Machine::Restore(const std::string &fileName) {
+  // Follow the chain of checkpoints back to a full snapshot first, and
+  // restore them from there on
+  std::vector<std::string> chain;
+  for (std::string name = fileName; !name.empty();
+       name = restoreState(name, true)) {
+    if (std::find(chain.begin(), chain.end(), name) != chain.end())
+      throw InvalidFileFormatError(name, "Checkpoint chain loops");
+    chain.push_back(name);
   }
+
+  for (std::vector<std::string>::reverse_iterator it = chain.rbegin();
+       it != chain.rend(); ++it)
+    restoreState(*it, false);
 }
 
-void Machine::Halt() { halted = true; }
+void Machine::Checkpoint(const std::string &fileName,
+                         const std::string &parent) {
+  FinishCheckpoint();
+
+  std::shared_ptr<SnapshotWriter> out(new SnapshotWriter(fileName, true));
+  saveState(*out, parent);
+  bus->ClearDirtyPages();
+
+  checkpointThread = std::thread([this, out]() {
+    try {
+      out->Close();
+    } catch (const Error &e) {
+      checkpointError = e.what();
+    }
+  });
+}
+
+void Machine::FinishCheckpoint() {
+  if (checkpointThread.joinable())
+    checkpointThread.join();
+
+  if (!checkpointError.empty()) {
+    std::string error;
+    error.swap(checkpointError);
+    throw Error(error);
+  }
+}
+
+void Machine::saveState(SnapshotWriter &out, const std::string &parent) const {
+  out.PutString(parent);
+  out.PutWord(cpus.size());
+  out.PutBool(halted);
+  bus->Save(out, !parent.empty());
+  for (Processor *cpu : cpus)
+    cpu->Save(out);
+}
+
+// This method restores the machine state saved to fileName, unless
+// chainOnly; it returns the file name of the checkpoint parent, or an
+// empty string for a full snapshot
+std::string Machine::restoreState(const std::string &fileName,
+                                  bool chainOnly) {
+  SnapshotReader in(fileName);
+
+  std::string parent = in.GetString();
+  size_t dirEnd = fileName.rfind('/');
+  if (!parent.empty() && parent[0] != '/' && dirEnd != std::string::npos)
+    parent = fileName.substr(0, dirEnd + 1) + parent;
+  if (chainOnly)
+    return parent;
+
+  in.Expect(cpus.size(), "Snapshot processors do not match the machine "
+                         "configuration");
+  halted = in.GetBool();
+  bus->Restore(in);
+  for (Processor *cpu : cpus)
+    cpu->Restore(in);
+  return parent;
+}
 
 void Machine::onCpuException(unsigned int excCode, Processor *cpu) {
   bool utlbExc = (excCode == UTLBLEXCEPTION || excCode == UTLBSEXCEPTION);
@@ -123,6 +381,12 @@ void Machine::onCpuStatusChanged(const Processor *cpu) {
 }
 
 void Machine::HandleBusAccess(Word pAddr, Word access, Processor *cpu) {
+  // Accesses made by devices (DMA) and by the bus itself (clock
+  // registers) have no processor: stops they cause are ascribed to
+  // processor 0
+  if (cpu == NULL)
+    cpu = cpus[0];
+
   // Check for breakpoints and suspects
   switch (access) {
   case READ:
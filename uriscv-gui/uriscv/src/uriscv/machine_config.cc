@@ -108,8 +108,7 @@ MachineConfig *MachineConfig::LoadFromFile(const std::string &fileName,
       JsonObject *devices = root->Get("devices")->AsObject();
       for (unsigned int il = 0; il < N_EXT_IL; il++) {
         for (unsigned int devNo = 0; devNo < N_DEV_PER_IL; devNo++) {
-          std::string key =
-              boost::str(boost::format("%s%u") % deviceKeyPrefix[il] % devNo);
+          std::string key = DeviceName(il, devNo);
           if (devices->HasMember(key)) {
             JsonObject *devObj = devices->Get(key)->AsObject();
             config->setDeviceEnabled(il, devNo,
@@ -178,8 +177,7 @@ void MachineConfig::Save() {
         object->Set("file", devFiles[il][devNo]);
         if (il == EXT_IL_INDEX(IL_ETHERNET) && getMACId(devNo))
           object->Set("address", MACIdToString(getMACId(devNo)));
-        std::string key =
-            boost::str(boost::format("%s%u") % deviceKeyPrefix[il] % devNo);
+        std::string key = DeviceName(il, devNo);
         devicesObject->Set(key, object);
       }
     }
@@ -196,6 +194,25 @@ void MachineConfig::Save() {
   file.flush();
 }
 
+bool MachineConfig::ParseDeviceName(const std::string &name, unsigned int *il,
+                                    unsigned int *devNo) {
+  for (unsigned int i = 0; i < N_EXT_IL; i++) {
+    for (unsigned int n = 0; n < N_DEV_PER_IL; n++) {
+      if (name == DeviceName(i, n)) {
+        *il = i;
+        *devNo = n;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+std::string MachineConfig::DeviceName(unsigned int il, unsigned int devNo) {
+  assert(il < N_EXT_IL && devNo < N_DEV_PER_IL);
+  return boost::str(boost::format("%s%u") % deviceKeyPrefix[il] % devNo);
+}
+
 MachineConfig::MachineConfig(const std::string &fn) : fileName(fn) {
   resetToFactorySettings();
 }
@@ -29,8 +29,17 @@
 
 #include "uriscv/memspace.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <vector>
 
 #include <boost/format.hpp>
 
@@ -38,65 +47,194 @@
 #include "uriscv/blockdev_params.h"
 #include "uriscv/const.h"
 #include "uriscv/error.h"
+#include "uriscv/snapshot.h"
+
+// Regions at least this large are worth backing with huge pages
+HIDDEN const size_t kHugePageSize = 2 * 1024 * 1024;
+
+// Snapshot page records: the page index, then its contents unless the
+// record is for a zeroed page; a record with kEndOfPages ends the list
+HIDDEN const Word kZeroPage = 1U << 31;
+HIDDEN const Word kEndOfPages = MAXWORDVAL;
+
+// This function tells whether the words words at page are all zero; it
+// is a plain OR reduction, which the compiler vectorizes
+HIDDEN bool isZero(const Word *page, Word words) {
+  Word bits = 0;
+  for (Word i = 0; i < words; i++)
+    bits |= page[i];
+  return bits == 0;
+}
+
+// This function rounds size up to a multiple of the host page size
+HIDDEN size_t pageAlign(size_t size) {
+  const size_t pageSize = sysconf(_SC_PAGESIZE);
+  return (size + pageSize - 1) & ~(pageSize - 1);
+}
 
 // This method creates a RamSpace object of a given size (in words) and
 // fills it with core file contents if needed
 RamSpace::RamSpace(Word size_, const char *fName)
-    : ram(new Word[size_]), size(size_) {
+    : size(size_), numPages((size_ + kPageWords - 1) >> kPageShift),
+      dirty(new uint32_t[(numPages + 31) / 32]) {
+  // Nothing has been checkpointed yet
+  memset(dirty.get(), 0xff, (numPages + 31) / 32 * sizeof(uint32_t));
+
+  int fd = -1;
+  size_t fileSize = 0;
+
   if (fName != NULL && *fName) {
-    FILE *cFile;
-    if ((cFile = fopen(fName, "r")) == NULL)
+    if ((fd = open(fName, O_RDONLY)) == -1)
       throw FileError(fName);
 
     // Check validity
     Word tag;
-    if (fread((void *)&tag, WORDLEN, 1, cFile) != 1 || tag != COREFILEID) {
-      fclose(cFile);
+    struct stat st;
+    if (pread(fd, &tag, WORDLEN, 0) != WORDLEN || tag != COREFILEID) {
+      close(fd);
       throw InvalidCoreFileError(fName, "Invalid core file");
     }
+    if (fstat(fd, &st) == -1) {
+      close(fd);
+      throw ReadingError();
+    }
+    fileSize = st.st_size;
+    if (fileSize - WORDLEN > (size_t)size * WORDLEN) {
+      close(fd);
+      throw CoreFileOverflow();
+    }
+  }
 
-    if (fread((void *)ram.get(), WORDLEN, size, cFile) != size)
-      if (ferror(cFile)) {
-        fclose(cFile);
-        throw ReadingError();
-      }
+  // Pages are only backed by host memory when touched, so memory need
+  // not be reserved up front
+  mappingSize = pageAlign(WORDLEN + (size_t)size * WORDLEN);
+  mapping = mmap(NULL, mappingSize, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mapping == MAP_FAILED) {
+    if (fd != -1)
+      close(fd);
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (mappingSize >= kHugePageSize)
+    madvise(mapping, mappingSize, MADV_HUGEPAGE);
+#endif
+
+  // Lay the core file over the start of the region, tag included: the
+  // file pages are shared with the page cache until written to
+  if (fd != -1) {
+    void *core = mmap(mapping, pageAlign(fileSize), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_FIXED, fd, 0);
+    close(fd);
+    if (core == MAP_FAILED) {
+      munmap(mapping, mappingSize);
+      throw ReadingError();
+    }
+  }
 
-    if (!feof(cFile)) {
-      fclose(cFile);
-      throw CoreFileOverflow();
+  ram = (Word *)mapping + 1;
+}
+
+RamSpace::~RamSpace() { munmap(mapping, mappingSize); }
+
+void RamSpace::ClearDirty() {
+  memset(dirty.get(), 0, (numPages + 31) / 32 * sizeof(uint32_t));
+}
+
+void RamSpace::Save(SnapshotWriter &out, bool dirtyOnly) const {
+  out.PutWord(size);
+  out.PutBool(dirtyOnly);
+
+  for (Word page = 0; page < numPages; page++) {
+    if (dirtyOnly && !IsDirty(page))
+      continue;
+
+    const Word *mem = &ram[page << kPageShift];
+    const Word words = std::min(kPageWords, size - (page << kPageShift));
+    if (!isZero(mem, words)) {
+      out.PutWord(page);
+      out.Put(mem, words * WORDLEN);
+    } else if (dirtyOnly) {
+      // it may not have been zero in the snapshot this one is
+      // restored over
+      out.PutWord(page | kZeroPage);
     }
+  }
+  out.PutWord(kEndOfPages);
+}
 
-    fclose(cFile);
+void RamSpace::Restore(SnapshotReader &in) {
+  in.Expect(size, "Snapshot RAM size does not match the machine "
+                  "configuration");
+  const bool incremental = in.GetBool();
+
+  std::vector<bool> restored(numPages);
+  for (Word record = in.GetWord(); record != kEndOfPages;
+       record = in.GetWord()) {
+    const Word page = record & ~kZeroPage;
+    if (page >= numPages)
+      throw InvalidFileFormatError(in.getFileName(), "Invalid snapshot page");
+
+    Word *mem = &ram[page << kPageShift];
+    const Word words = std::min(kPageWords, size - (page << kPageShift));
+    if (record & kZeroPage)
+      memset(mem, 0, words * WORDLEN);
+    else
+      in.Get(mem, words * WORDLEN);
+    restored[page] = true;
   }
+
+  // Pages left out of a full snapshot are zero; clearing only those
+  // which are not leaves untouched memory unallocated
+  if (!incremental) {
+    for (Word page = 0; page < numPages; page++) {
+      Word *mem = &ram[page << kPageShift];
+      const Word words = std::min(kPageWords, size - (page << kPageShift));
+      if (!restored[page] && !isZero(mem, words))
+        memset(mem, 0, words * WORDLEN);
+    }
+  }
+
+  memset(dirty.get(), 0xff, (numPages + 31) / 32 * sizeof(uint32_t));
 }
 
 /****************************************************************************/
 
-// This method creates a BiosSpace object, filling with .rom file contents
+// This method creates a BiosSpace object, mapping .rom file contents
 BiosSpace::BiosSpace(const char *fileName) {
   assert(fileName != NULL && *fileName);
 
-  FILE *file;
+  int fd;
 
-  if ((file = fopen(fileName, "r")) == NULL)
+  if ((fd = open(fileName, O_RDONLY)) == -1)
     throw FileError(fileName);
 
-  Word tag;
-  if ((fread((void *)&tag, WS, 1, file) != 1) || (tag != BIOSFILEID) ||
-      (fread((void *)&size, WS, 1, file) != 1)) {
-    fclose(file);
+  // .rom file header: tag and size (in words)
+  Word header[2];
+  struct stat st;
+  if (pread(fd, header, sizeof(header), 0) != sizeof(header) ||
+      header[0] != BIOSFILEID || fstat(fd, &st) == -1) {
+    close(fd);
     throw InvalidFileFormatError(fileName, "ROM file expected");
   }
 
-  memPtr.reset(new Word[size]);
-  if (fread((void *)memPtr.get(), WS, size, file) != size) {
-    fclose(file);
+  size = header[1];
+  mappingSize = sizeof(header) + (size_t)size * WS;
+  if ((size_t)st.st_size < mappingSize) {
+    close(fd);
     throw InvalidFileFormatError(fileName, "Wrong ROM file size");
   }
 
-  fclose(file);
+  mapping = mmap(NULL, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    throw ReadingError();
+
+  memPtr = (const Word *)mapping + 2;
 }
 
+BiosSpace::~BiosSpace() { munmap(mapping, mappingSize); }
+
 // This method returns the value of Word at ofs address
 // (SystemBus must assure that ofs is in range)
 Word BiosSpace::MemRead(Word ofs) {
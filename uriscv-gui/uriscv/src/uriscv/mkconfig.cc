@@ -111,7 +111,7 @@ int main(int argc, char *argv[]) {
       "tlb-floor", po::value<int>()->default_value(defTlbFloor),
       "TLB floor { 0x0(RAMTOP) | 0x4000000 | 0x8000000 | 0xFFFFFFFF(OFF) }")(
       "ram-size", po::value<int>()->default_value(defRamSize),
-      "Size of the RAM")("boot-bios",
+      "Size of the RAM (in frames)")("boot-bios",
                          po::value<std::string>()->default_value(defBootBios),
                          "Path of the ROM with the bootstrap instructions")(
       "exec-bios", po::value<std::string>()->default_value(defExecBios),
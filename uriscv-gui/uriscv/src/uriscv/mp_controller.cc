@@ -21,17 +21,14 @@
 
 #include "uriscv/mp_controller.h"
 
-#include <boost/bind/bind.hpp>
-
 #include "base/lang.h"
 #include "uriscv/arch.h"
 #include "uriscv/machine.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/processor.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/systembus.h"
 
-using namespace boost::placeholders;
-
 MPController::MPController(const MachineConfig *config, Machine *machine)
     : config(config), machine(machine), bootPC(MCTL_DEFAULT_BOOT_PC),
       bootSP(MCTL_DEFAULT_BOOT_SP) {}
@@ -63,10 +60,9 @@ void MPController::Write(Word addr, Word data, const Processor *cpu) {
   case MCTL_RESET_CPU:
     cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
     if (cpuId < config->getNumProcessors())
-      machine->getBus()->scheduleEvent(kCpuResetDelay * config->getClockRate(),
-                                       boost::bind(&Processor::Reset,
-                                                   machine->getProcessor(cpuId),
-                                                   bootPC, bootSP));
+      machine->getBus()->scheduleEvent(
+          kCpuResetDelay * config->getClockRate(),
+          EventTag(EventTag::ET_CPU_RESET, cpuId, bootPC, bootSP));
     break;
 
   case MCTL_BOOT_PC:
@@ -80,18 +76,27 @@ void MPController::Write(Word addr, Word data, const Processor *cpu) {
   case MCTL_HALT_CPU:
     cpuId = data & MCTL_RESET_CPU_CPUID_MASK;
     if (cpuId < config->getNumProcessors())
-      machine->getBus()->scheduleEvent(
-          kCpuHaltDelay * config->getClockRate(),
-          boost::bind(&Processor::Halt, machine->getProcessor(cpuId)));
+      machine->getBus()->scheduleEvent(kCpuHaltDelay * config->getClockRate(),
+                                       EventTag(EventTag::ET_CPU_HALT, cpuId));
     break;
 
   case MCTL_POWER:
     if (data == 0x0FF)
       machine->getBus()->scheduleEvent(kPoweroffDelay * config->getClockRate(),
-                                       boost::bind(&Machine::Halt, machine));
+                                       EventTag(EventTag::ET_POWEROFF));
     break;
 
   default:
     break;
   }
 }
+
+void MPController::Save(SnapshotWriter &out) const {
+  out.PutWord(bootPC);
+  out.PutWord(bootSP);
+}
+
+void MPController::Restore(SnapshotReader &in) {
+  bootPC = in.GetWord();
+  bootSP = in.GetWord();
+}
@@ -21,16 +21,14 @@
 
 #include "uriscv/mpic.h"
 
-#include <boost/bind/bind.hpp>
 #include <cassert>
 
 #include "uriscv/arch.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/processor.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/systembus.h"
 
-using namespace boost::placeholders;
-
 InterruptController::InterruptController(const MachineConfig *config,
                                          SystemBus *bus)
     : config(config), bus(bus), arbiter(0),
@@ -188,9 +186,8 @@ void InterruptController::Write(Word addr, Word data, const Processor *cpu) {
       break;
 
     case CPUCTL_OUTBOX:
-      bus->scheduleEvent(
-          kIpiLatency * config->getClockRate(),
-          boost::bind(&InterruptController::deliverIPI, this, cpu->Id(), data));
+      bus->scheduleEvent(kIpiLatency * config->getClockRate(),
+                         EventTag(EventTag::ET_IPI, cpu->Id(), data));
       break;
 
     case CPUCTL_TPR:
@@ -211,7 +208,7 @@ void InterruptController::Write(Word addr, Word data, const Processor *cpu) {
   }
 }
 
-void InterruptController::deliverIPI(unsigned int origin, Word outbox) {
+void InterruptController::DeliverIPI(unsigned int origin, Word outbox) {
   Word recipients = CPUCTL_OUTBOX_GET_RECIP(outbox);
 
   for (unsigned int i = 0; i < config->getNumProcessors(); i++) {
@@ -234,3 +231,57 @@ void InterruptController::deliverIPI(unsigned int origin, Word outbox) {
     }
   }
 }
+
+void InterruptController::Save(SnapshotWriter &out) const {
+  out.PutWord(arbiter);
+
+  for (const auto &line : sources) {
+    for (const Source &source : line) {
+      out.PutWord(source.lastTarget);
+      out.PutWord(source.route.destination);
+      out.PutWord(source.route.policy);
+    }
+  }
+
+  for (const CpuData &cd : cpuData) {
+    out.PutWord(cd.ipMask);
+    for (Word data : cd.idb)
+      out.PutWord(data);
+    out.PutWord(cd.ipiInbox.size());
+    for (const IpiMessage &ipi : cd.ipiInbox) {
+      out.PutWord(ipi.origin);
+      out.PutWord(ipi.msg);
+    }
+    out.PutWord(cd.taskPriority);
+    out.PutWord(cd.biosReserved[0]);
+    out.PutWord(cd.biosReserved[1]);
+  }
+}
+
+void InterruptController::Restore(SnapshotReader &in) {
+  arbiter = in.GetWord();
+
+  for (auto &line : sources) {
+    for (Source &source : line) {
+      source.lastTarget = in.GetWord();
+      source.route.destination = in.GetWord();
+      source.route.policy = in.GetWord();
+    }
+  }
+
+  for (CpuData &cd : cpuData) {
+    cd.ipMask = in.GetWord();
+    for (Word &data : cd.idb)
+      data = in.GetWord();
+    cd.ipiInbox.clear();
+    for (Word n = in.GetWord(); n > 0; n--) {
+      IpiMessage ipi;
+      ipi.origin = in.GetWord();
+      ipi.msg = in.GetWord();
+      cd.ipiInbox.push_back(ipi);
+    }
+    cd.taskPriority = in.GetWord();
+    cd.biosReserved[0] = in.GetWord();
+    cd.biosReserved[1] = in.GetWord();
+  }
+}
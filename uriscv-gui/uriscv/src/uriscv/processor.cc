@@ -32,6 +32,7 @@
 
 #include "uriscv/processor.h"
 
+#include <algorithm>
 #include <cassert>
 #include <complex>
 #include <cstdio>
@@ -44,15 +45,25 @@
 #include "uriscv/const.h"
 #include "uriscv/cpu.h"
 #include "uriscv/csr.h"
+#include "uriscv/decode_cache.h"
 #include "uriscv/disassemble.h"
 #include "uriscv/error.h"
+#include "uriscv/jit.h"
 #include "uriscv/machine.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/processor_defs.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/systembus.h"
 #include "uriscv/types.h"
 #include "uriscv/utility.h"
 
+// This macro prints a trace message from code specialized on a feature
+// mask F: the test is resolved at compile time when F does not include
+// EF_TRACE
+#define TRACEMSG(...)                                                          \
+  if ((F & EF_TRACE) && DISASS)                                                \
+    printf(__VA_ARGS__);
+
 const char *const regName[] = {
     "zero", "ra", "sp", "gp", "tp",  "t0",  "t1", "t2", "s0/fp", "s1", "a0",
     "a1",   "a2", "a3", "a4", "a5",  "a6",  "a7", "s2", "s3",    "s4", "s5",
@@ -153,92 +164,26 @@ bool TLBEntry::IsD() { return BitVal(tlbLO, DBITPOS); }
 
 Processor::Processor(const MachineConfig *config, Word cpuId, Machine *machine,
                      SystemBus *bus)
-    : id(cpuId), config(config), machine(machine), bus(bus), status(PS_HALTED),
+    : id(cpuId), config(config), machine(machine), bus(bus),
+      decodeCache(bus->getDecodeCache(cpuId)), jit(bus->getJit()),
+      jitCheckLeft(0), execFeatures(kAllExecFeatures),
+      cycleImpl(&Processor::cycle<kAllExecFeatures>),
+      execBlockImpl(&Processor::execBlock<kAllExecFeatures>),
+      inQuantum(false), quantumParallel(false), localTicks(0),
+      status(PS_HALTED), csr(new Word[kNumCSRRegisters]()),
       tlbSize(config->getTLBSize()), tlb(new TLBEntry[tlbSize]),
-      tlbFloorAddress(config->getTLBFloorAddress()) {
-  initCSR();
+      tlbFloorAddress(config->getTLBFloorAddress()), csrMStatus(0),
+      csrMIE(0), csrMIP(0), csrTime(0), timeRunning(false), timeDeadline(0), csrEntryHi(0),
+      csrRandom(0) {
+  flushMicroTLB();
 }
 
 Processor::~Processor() {}
 
-void Processor::initCSR() {
-  csr[CYCLE].perm = RRR;
-  csr[CYCLEH].perm = NNW;
-  csr[MCYCLE].perm = RRR;
-  csr[MCYCLEH].perm = RRR;
-
-  csr[TIME].perm = RRR;
-  csr[TIMEH].perm = RRR;
-
-  csr[INSTRET].perm = RRR;
-  csr[MINSTRET].perm = NNW;
-  csr[INSTRETH].perm = RRR;
-  csr[MINSTRETH].perm = NNW;
-
-  csr[0x000].perm = WWW;
-  csr[0x100].perm = NWW;
-  csr[0x300].perm = NNW;
-
-  csr[0x004].perm = WWW;
-  csr[0x104].perm = NWW;
-  csr[0x304].perm = NNW;
-
-  csr[UTVEC].perm = WWW;
-  csr[STVEC].perm = NWW;
-  csr[MTVEC].perm = NNW;
-
-  csr[0x102].perm = NWW;
-  csr[0x302].perm = NNW;
-
-  csr[0x103].perm = NWW;
-  csr[0x303].perm = NNW;
-
-  csr[0x106].perm = NWW;
-  csr[0x306].perm = NNW;
-
-  for (Word i = 0; i < 5; i++) {
-    csr[0x040 + i].perm = WWW;
-    csr[0x140 + i].perm = NWW;
-    csr[0x340 + i].perm = NNW;
-  }
-
-  csr[0x180].perm = NWW;
-
-  csr[0x301].perm = NNW;
-  csr[0xF11].perm = NNR;
-  csr[0xF12].perm = NNR;
-  csr[0xF13].perm = NNR;
-  csr[0xF14].perm = NNR;
-
-  csr[0x001].perm = WWW;
-  csr[0x002].perm = WWW;
-  csr[0x003].perm = WWW;
-
-  for (Word i = 0; i < 0x33F - 0x323 + 1; i++) {
-    csr[0x323 + i].perm = NNW;
-    csr[0xC03 + i].perm = RRR;
-    csr[0xB03 + i].perm = NNW;
-    csr[0xC83 + i].perm = RRR;
-    csr[0xB83 + i].perm = NNW;
-  }
-
-  csr[0x3A0].perm = NNW;
-  csr[0x3A1].perm = NNW;
-  csr[0x3A2].perm = NNW;
-  csr[0x3A3].perm = NNW;
-
-  for (Word i = 0; i < 0xF; i++) {
-    csr[0x3B0 + i].perm = NNW;
-  }
-
-  for (Word i = 0; i < 0x7B2 - 0x7A0 + 1; i++) {
-    csr[0x7A0 + i].perm = NNW;
-  }
-}
-
 void Processor::setStatus(ProcessorStatus newStatus) {
   if (status != newStatus) {
     status = newStatus;
+    updateTimer();
     StatusChanged.emit();
   }
 }
@@ -274,12 +219,12 @@ void Processor::Reset(Word pc, Word sp) {
   prevPhysPC = MAXWORDVAL;
   prevInstr = NOP;
 
-  csrWrite(CSR_ENTRYHI, 0);
+  csrEntryHi = 0;
   csrWrite(CSR_ENTRYLO, 0);
   csrWrite(CSR_INDEX, 0);
   csrWrite(CSR_BADVADDR, 0);
-  csrWrite(CSR_RANDOM, ((tlbSize - 1UL) << RNDIDXOFFS) - RANDOMSTEP);
-  csrWrite(MSTATUS, MSTATUS_MPP_M);
+  csrRandom = ((tlbSize - 1UL) << RNDIDXOFFS) - RANDOMSTEP;
+  csrMStatus = MSTATUS_MPP_M;
   csrWrite(MIE, 0);
   csrWrite(MCAUSE, 0);
   csrWrite(TIME, 0);
@@ -289,7 +234,7 @@ void Processor::Reset(Word pc, Word sp) {
 
   // maps PC to physical address space and fetches first instruction
   // mapVirtual and SystemBus cannot signal TRUE on this call
-  if (mapVirtual(currPC, &currPhysPC, EXEC) ||
+  if (mapVirtual<kAllExecFeatures>(currPC, &currPhysPC, EXEC) ||
       bus->InstrRead(currPhysPC, &currInstr, this))
     Panic("Illegal memory access in Processor::Reset");
 
@@ -317,21 +262,52 @@ void Processor::Halt() { setStatus(PS_HALTED); }
 // occurs, first instruction at vector address is loaded, so a new Cycle()
 // may start.
 // Other MIPS-specific minor tasks are performed at proper points.
-void Processor::Cycle() {
+void Processor::Cycle() { (this->*cycleImpl)(); }
+
+// This method selects the instrumentation the execution loop has to
+// include: features is a mask of ExecFeature values. Instructions
+// decoded for the previous selection are discarded, since they refer to
+// the handlers instantiated for it.
+void Processor::setExecFeatures(unsigned int features) {
+  if (features == execFeatures)
+    return;
+
+  execFeatures = features;
+  switch (features) {
+  case 0:
+    selectExecFeatures<0>();
+    break;
+  case EF_TRACE:
+    selectExecFeatures<EF_TRACE>();
+    break;
+  case EF_WATCH:
+    selectExecFeatures<EF_WATCH>();
+    break;
+  default:
+    selectExecFeatures<kAllExecFeatures>();
+    break;
+  }
+  decodeCache->Flush();
+}
+
+template <unsigned int F> void Processor::selectExecFeatures() {
+  cycleImpl = &Processor::cycle<F>;
+  execBlockImpl = &Processor::execBlock<F>;
+}
+
+template <unsigned int F> void Processor::cycle() {
 
   // Nothing to do if the cpu is halted
   if (isHalted())
     return;
 
-  // Update internal timer
-  // read MIE bit
-  if (csrRead(MIE) & MIE_MTIE_MASK) {
-    if (csrRead(TIME) == 0) {
-      AssertIRQ(IL_CPUTIMER);
-    }
-    csrWrite(TIME, csrRead(TIME) - 1);
-  } else {
+  // Internal timer: its interrupt is raised on the clock tick it
+  // reaches zero at (see updateTimer())
+  if (!timeRunning) {
     DeassertIRQ(IL_CPUTIMER);
+  } else if (clockNow() == timeDeadline) {
+    AssertIRQ(IL_CPUTIMER);
+    timeDeadline += UINT64_C(1) << 32;
   }
 
   // In low-power state, only the per-cpu timer keeps running
@@ -340,7 +316,7 @@ void Processor::Cycle() {
   }
 
   // Instruction decode & exec
-  if (!skipCycle && execInstr(currInstr))
+  if (!skipCycle && execInstr<F>())
     handleExc();
 
   // Check if we entered sleep mode as a result of the last
@@ -371,8 +347,13 @@ void Processor::Cycle() {
   if (skipCycle)
     skipCycle = false;
 
-  // processor cycle fetch part
-  if (mapVirtual(currPC, &currPhysPC, EXEC)) {
+  fetchInstr<F>();
+}
+
+// This method is the processor cycle fetch part: the instruction at
+// currPC is located and loaded into currInstr
+template <unsigned int F> void Processor::fetchInstr() {
+  if (mapVirtual<F>(currPC, &currPhysPC, EXEC)) {
     // TLB or Address exception caused: current instruction is nullified
     // currInstr = NOP;
     handleExc();
@@ -384,20 +365,320 @@ void Processor::Cycle() {
     skipCycle = true;
   }
 }
+
+// This method makes Processor run up to cycles instructions without
+// going through Cycle() for each of them. Basic blocks are run one after
+// the other as long as control stays inside the page the block was
+// entered in: fetches there can skip address translation (mode, TLB and
+// ASID cannot change without a CSR or system instruction, which are left
+// to Cycle()). Bus time (and with it the per-cpu timer) is advanced
+// lazily, before each memory access and on return, since nothing else
+// can observe it;
+// interrupts are checked after every instruction, as Cycle() does.
+// The block is left on exceptions, interrupts, page crossings and
+// interpreted stores (a device register write may start a processor,
+// schedule an event or halt the machine; translated code only stores
+// to RAM).
+// With EF_WATCH, the block ends right after the instruction that
+// requested a machine stop, and instructions in a page breakpoints may
+// cover are fetched through fetchInstr(), as Cycle() does; translated
+// code, which notifies no accesses, only runs from other pages, and
+// only while suspects cannot stop the machine.
+// When the JIT is enabled, blocks that have been translated are run as
+// host code instead of being interpreted; the JIT is not used by a
+// processor running in parallel with the others, since it is shared.
+uint32_t Processor::ExecBlock(uint32_t cycles) {
+  return (this->*execBlockImpl)(cycles);
+}
+
+template <unsigned int F> uint32_t Processor::execBlock(uint32_t cycles) {
+  if (isHalted() || isIdle() || skipCycle)
+    return 0;
+
+  // The per-cpu timer must not reach zero inside the block
+  if (timeRunning)
+    cycles = std::min(cycles, getTime());
+  else
+    DeassertIRQ(IL_CPUTIMER);
+
+  const Word vpn = VPN(currPC);
+  const Word pfn = VPN(currPhysPC);
+  const bool watchFetch =
+      (F & EF_WATCH) && machine->BreakpointsOnPage(
+                            ENTRYHI_GET_ASID(csrEntryHi), currPC, currPhysPC);
+  const bool useJit =
+      jit != NULL && !DISASS && !quantumParallel &&
+      !((Word)(vpn | ~VPNMASK) >= KUSEGBASE && vpn < tlbFloorAddress) &&
+      !(F & EF_WATCH && (watchFetch || machine->SuspectsActive()));
+  uint32_t done = 0, synced = 0;
+  bool blockStart = true, jitExit = false;
+  jitCheckLeft = 0;
+
+  while (done < cycles) {
+    DecodedInstr *di = decodeCache->Lookup(currPhysPC);
+    if (di->handler == NULL) {
+      Word word;
+      if (bus->InstrReadGDB(currPhysPC, &word, this) || word != currInstr)
+        break;
+      decodeInstr<F>(currInstr, di);
+    }
+    if (di->flags & DecodedInstr::DI_SYSTEM)
+      break;
+    if (quantumParallel &&
+        (di->flags & (DecodedInstr::DI_LOAD | DecodedInstr::DI_STORE)) &&
+        !parallelSafe(di))
+      break;
+
+    bool exc = false, store = false;
+    uint32_t n = 0;
+    if (useJit && blockStart && jitCheckLeft == 0)
+      n = execJit(cycles - done);
+
+    if (n > 0) {
+      // Translated code stops at a block exit or before an instruction
+      // it cannot run: either way a block starts there, which may have
+      // been translated too
+      done += n;
+      jitExit = true;
+    } else {
+      done++;
+      if (di->flags & (DecodedInstr::DI_LOAD | DecodedInstr::DI_STORE)) {
+        advanceClock(done - synced);
+        synced = done;
+      }
+
+      exc = (this->*di->handler)(di);
+      if (exc)
+        handleExc();
+
+      prevPC = currPC;
+      prevPhysPC = currPhysPC;
+      prevInstr = currInstr;
+
+      randomRegTick();
+
+      currPC = nextPC;
+      nextPC = succPC;
+      succPC += WORDLEN;
+
+      if (jitCheckLeft > 0 && --jitCheckLeft == 0)
+        checkJit();
+
+      store = di->flags & DecodedInstr::DI_STORE;
+      blockStart = jitExit || di->flags != 0;
+      jitExit = false;
+    }
+
+    if (checkForInt()) {
+      handleExc();
+      exc = true;
+    }
+
+    if (exc || VPN(currPC) != vpn || BADADDR(currPC) ||
+        INBOUNDS(currPC, KUSEGBASE, tlbFloorAddress)) {
+      advanceClock(done - synced);
+      fetchInstr<F>();
+      return done;
+    }
+
+    if (watchFetch) {
+      fetchInstr<F>();
+      if (skipCycle) {
+        advanceClock(done - synced);
+        return done;
+      }
+    } else {
+      // Same page: the physical address follows from the block's one
+      currPhysPC = pfn | (currPC & ~VPNMASK);
+      DecodedInstr *next = decodeCache->Lookup(currPhysPC);
+      if (next->handler != NULL) {
+        currInstr = next->instr;
+      } else if (bus->InstrReadGDB(currPhysPC, &currInstr, this)) {
+        advanceClock(done - synced);
+        fetchInstr<F>();
+        return done;
+      }
+    }
+
+    if ((F & EF_WATCH) && machine->StopRequested())
+      break;
+    if (store)
+      break;
+  }
+
+  advanceClock(done - synced);
+  return done;
+}
+
+// This method runs the translated code (if any) for the block at currPC,
+// for at most cycles cycles, and updates the processor state as if the
+// instructions run had gone through Cycle(). It returns the number of
+// instructions run. Translated loads and stores only access RAM and ROM
+// pages, so the bus clock needs no update for them.
+// In JIT check mode the code is run on a copy of the registers instead,
+// and its results are checked (see checkJit()) once the interpreter has
+// run the same instructions
+uint32_t Processor::execJit(uint32_t cycles) {
+  JitCode code = jit->Lookup(currPC, currPhysPC);
+  if (code == NULL)
+    return 0;
+
+  JitContext ctx;
+  ctx.budget = cycles;
+  ctx.pc = currPC;
+  ctx.lastPC = currPC;
+  // Kernel mode addresses below both the TLB floor and KUSEGBASE are
+  // physical ones (see mapVirtual()); the rest is left to the interpreter
+  ctx.readLimit =
+      InUserMode() ? 0 : std::min(tlbFloorAddress, (Word)KUSEGBASE) & VPNMASK;
+  ctx.writeLimit = ctx.readLimit;
+
+  if (JITCHECK) {
+    // The interpreter runs the same instructions afterwards, so memory
+    // must not be changed meanwhile
+    ctx.writeLimit = 0;
+    std::memcpy(jitCheckGPR, gpr, sizeof(gpr));
+    code(jitCheckGPR, &ctx);
+    jitCheckLeft = cycles - ctx.budget;
+    jitCheckPC = ctx.pc;
+    return 0;
+  }
+
+  code(gpr, &ctx);
+  uint32_t n = cycles - ctx.budget;
+  if (n == 0)
+    return 0;
+
+  // Translated code never leaves the page it was entered in
+  prevPC = ctx.lastPC;
+  prevPhysPC = VPN(currPhysPC) | (ctx.lastPC & ~VPNMASK);
+  bus->InstrReadGDB(prevPhysPC, &prevInstr, this);
+
+  for (uint32_t i = 0; i < n; i++)
+    randomRegTick();
+
+  currPC = ctx.pc;
+  succPC += n * WORDLEN;
+  nextPC = succPC - WORDLEN;
+
+  return n;
+}
+
+// This method compares the processor state with the one computed by
+// translated code in JIT check mode, stopping the simulation if they
+// differ
+void Processor::checkJit() {
+  bool ok = (currPC == jitCheckPC);
+  for (unsigned int i = 1; i < kNumCPURegisters; i++)
+    ok = ok && (gpr[i] == jitCheckGPR[i]);
+  if (ok)
+    return;
+
+  ERRORMSG("JIT check failed before %x (JIT stopped at %x)\n", currPC,
+           jitCheckPC);
+  for (unsigned int i = 1; i < kNumCPURegisters; i++)
+    if (gpr[i] != jitCheckGPR[i])
+      ERRORMSG("  %s: interpreter %x, JIT %x\n", regName[i], gpr[i],
+               jitCheckGPR[i]);
+  Panic("JIT and interpreter results differ");
+}
+
+// This method accounts cycles clock ticks run by ExecBlock() to the bus,
+// or to the current quantum
+void Processor::advanceClock(uint32_t cycles) {
+  if (inQuantum)
+    localTicks += cycles;
+  else if (cycles != 0)
+    bus->Skip(cycles);
+}
+
+uint32_t Processor::RunQuantum(uint32_t cycles, bool parallel) {
+  inQuantum = true;
+  quantumParallel = parallel;
+
+  uint32_t done = 0;
+  while (done < cycles) {
+    uint32_t n;
+    if (isHalted() || isIdle()) {
+      // Only the per-cpu timer may wake the processor up meanwhile
+      n = std::min(cycles - done, IdleCycles());
+      localTicks += n;
+    } else {
+      n = ExecBlock(cycles - done);
+    }
+
+    if (n == 0) {
+      if (parallel)
+        break;
+      localTicks++;
+      Cycle();
+      n = 1;
+    }
+    done += n;
+  }
+
+  inQuantum = false;
+  quantumParallel = false;
+  return done;
+}
+
+void Processor::EndQuantum() { localTicks = 0; }
+
+// This method returns the current bus clock value as seen by the
+// processor, which runs ahead of the bus during a quantum
+uint64_t Processor::clockNow() const { return bus->getToD() + localTicks; }
+
+// This method tells whether the load or store di, about to be executed,
+// may be run in parallel with the other processors: its address must
+// translate without exceptions to memory SystemBus::ParallelSafe()
+// allows (anything else is left to the serial part of the quantum)
+bool Processor::parallelSafe(const DecodedInstr *di) {
+  const bool write = di->flags & DecodedInstr::DI_STORE;
+  Word paddr;
+  return peekVirtual(regRead(di->rs1) + di->imm, &paddr, write) &&
+         bus->ParallelSafe(paddr, write);
+}
+
 uint32_t Processor::IdleCycles() {
   if (isHalted())
     return (uint32_t)-1;
   else if (isIdle())
-    return (csrRead(MIE) & MIE_MTIE_MASK) ? csrRead(TIME) : (uint32_t)-1;
+    return timeRunning ? getTime() : (uint32_t)-1;
   else
     return 0;
 }
 
-void Processor::Skip(uint32_t cycles) {
-  assert(isIdle() && cycles <= IdleCycles());
+// The per-cpu timer counts down on every cycle while it is enabled in
+// MIE and the processor is not halted. Instead of being decremented, a
+// running timer is kept as the bus clock tick it reaches zero at
+// (timeDeadline), and csrTime only holds the value of a stopped one.
+
+// This method returns the current value of the per-cpu timer
+Word Processor::getTime() const {
+  if (timeRunning)
+    return (Word)(timeDeadline - clockNow() - 1);
+  else
+    return csrTime;
+}
+
+// This method sets the per-cpu timer to value
+void Processor::setTime(Word value) {
+  if (timeRunning)
+    timeDeadline = clockNow() + 1 + value;
+  else
+    csrTime = value;
+}
+
+// This method starts or stops the per-cpu timer, after MIE or the
+// processor status have changed
+void Processor::updateTimer() {
+  const bool running = (csrMIE & MIE_MTIE_MASK) && !isHalted();
+  if (running == timeRunning)
+    return;
 
-  if (csrRead(MIE) & MIE_MTIE_MASK)
-    csrWrite(TIME, csrRead(TIME) - cycles);
+  const Word value = getTime();
+  timeRunning = running;
+  setTime(value);
 }
 
 // This method allows SystemBus and Processor itself to signal Processor
@@ -418,7 +699,7 @@ void Processor::SignalExc(unsigned int exc, Word cpuNum) {
 
 void Processor::AssertIRQ(unsigned int il) {
 
-  csrWrite(MIP, csrRead(MIP) | CAUSE_IP(il));
+  csrMIP |= CAUSE_IP(il);
 
   // If in standby mode, go back to being a power hog.
   if (isIdle())
@@ -426,7 +707,94 @@ void Processor::AssertIRQ(unsigned int il) {
 }
 
 void Processor::DeassertIRQ(unsigned int il) {
-  csrWrite(MIP, csrRead(MIP) & ~CAUSE_IP(il));
+  csrMIP &= ~CAUSE_IP(il);
+}
+
+void Processor::Save(SnapshotWriter &out) const {
+  assert(!inQuantum);
+
+  out.PutWord(status);
+  out.PutWord(mode);
+  out.PutWord(excCause);
+  out.PutWord(copENum);
+  out.PutBool(isBranchD);
+  out.PutWord(loadPending);
+  out.PutWord(loadReg);
+  out.PutWord(loadVal);
+  out.PutBool(skipCycle);
+
+  out.Put(gpr, sizeof(gpr));
+  out.Put(csr.get(), kNumCSRRegisters * sizeof(Word));
+
+  out.PutWord(currInstr);
+  out.PutWord(prevPC);
+  out.PutWord(prevPhysPC);
+  out.PutWord(prevInstr);
+  out.PutWord(currPC);
+  out.PutWord(currPhysPC);
+  out.PutWord(nextPC);
+  out.PutWord(succPC);
+
+  out.PutWord(tlbSize);
+  for (size_t i = 0; i < tlbSize; i++) {
+    out.PutWord(tlb[i].getHI());
+    out.PutWord(tlb[i].getLO());
+  }
+
+  out.PutWord(csrMStatus);
+  out.PutWord(csrMIE);
+  out.PutWord(csrMIP);
+  out.PutWord(csrTime);
+  out.PutBool(timeRunning);
+  out.PutU64(timeDeadline);
+  out.PutWord(csrEntryHi);
+  out.PutWord(csrRandom);
+}
+
+void Processor::Restore(SnapshotReader &in) {
+  assert(!inQuantum);
+
+  status = (ProcessorStatus)in.GetWord();
+  mode = in.GetWord();
+  excCause = in.GetWord();
+  copENum = in.GetWord();
+  isBranchD = in.GetBool();
+  loadPending = (LoadTargetType)in.GetWord();
+  loadReg = in.GetWord();
+  loadVal = in.GetWord();
+  skipCycle = in.GetBool();
+
+  in.Get(gpr, sizeof(gpr));
+  in.Get(csr.get(), kNumCSRRegisters * sizeof(Word));
+
+  currInstr = in.GetWord();
+  prevPC = in.GetWord();
+  prevPhysPC = in.GetWord();
+  prevInstr = in.GetWord();
+  currPC = in.GetWord();
+  currPhysPC = in.GetWord();
+  nextPC = in.GetWord();
+  succPC = in.GetWord();
+
+  in.Expect(tlbSize, "Snapshot TLB size does not match the machine "
+                     "configuration");
+  for (size_t i = 0; i < tlbSize; i++) {
+    Word hi = in.GetWord();
+    tlb[i] = TLBEntry(hi, in.GetWord());
+  }
+  flushMicroTLB();
+
+  csrMStatus = in.GetWord();
+  csrMIE = in.GetWord();
+  csrMIP = in.GetWord();
+  csrTime = in.GetWord();
+  timeRunning = in.GetBool();
+  timeDeadline = in.GetU64();
+  csrEntryHi = in.GetWord();
+  csrRandom = in.GetWord();
+
+  jitCheckLeft = 0;
+  StatusChanged.emit();
 }
 
 // This method allows to get critical information on Processor current
@@ -434,14 +802,14 @@ void Processor::DeassertIRQ(unsigned int il) {
 // proper places inside Processor itself
 void Processor::getCurrStatus(Word *asid, Word *pc, Word *instr, bool *isLD,
                               bool *isBD) {
-  *asid = (ASID(csrRead(CSR_ENTRYHI))) >> ASIDOFFS;
+  *asid = (ASID(csrEntryHi)) >> ASIDOFFS;
   *pc = currPC;
   *instr = currInstr;
   *isLD = (loadPending != LOAD_TARGET_NONE);
   *isBD = isBranchD;
 }
 
-Word Processor::getASID() { return ASID(csrRead(CSR_ENTRYHI)) >> ASIDOFFS; }
+Word Processor::getASID() { return ASID(csrEntryHi) >> ASIDOFFS; }
 
 bool Processor::InUserMode() {
   // return (csrRead(MSTATUS) & MSTATUS_MPP_MASK) == MSTATUS_MPP_U;
@@ -526,11 +894,49 @@ void Processor::regWrite(Word reg, Word value) {
 }
 Word Processor::csrRead(Word reg) {
   assert(reg >= 0 && reg < kNumCSRRegisters);
-  return csr[reg].value;
+  switch (reg) {
+  case MSTATUS:
+    return csrMStatus;
+  case MIE:
+    return csrMIE;
+  case MIP:
+    return csrMIP;
+  case TIME:
+    return getTime();
+  case CSR_ENTRYHI:
+    return csrEntryHi;
+  case CSR_RANDOM:
+    return csrRandom;
+  default:
+    return csr[reg];
+  }
 }
 void Processor::csrWrite(Word reg, Word value) {
   assert(reg >= 0 && reg < kNumCSRRegisters);
-  csr[reg].value = value;
+  switch (reg) {
+  case MSTATUS:
+    csrMStatus = value;
+    break;
+  case MIE:
+    csrMIE = value;
+    updateTimer();
+    break;
+  case MIP:
+    csrMIP = value;
+    break;
+  case TIME:
+    setTime(value);
+    break;
+  case CSR_ENTRYHI:
+    csrEntryHi = value;
+    break;
+  case CSR_RANDOM:
+    csrRandom = value;
+    break;
+  default:
+    csr[reg] = value;
+    break;
+  }
 }
 
 // This method allows to modify the current value of a general purpose
@@ -559,6 +965,7 @@ void Processor::setTLB(unsigned int index, Word hi, Word lo) {
   if (index < tlbSize) {
     tlb[index].setHI(hi);
     tlb[index].setLO(lo);
+    flushMicroTLB();
     SignalTLBChanged(index);
   } else {
     Panic("Unknown TLB entry in Processor::setTLB()");
@@ -568,12 +975,14 @@ void Processor::setTLB(unsigned int index, Word hi, Word lo) {
 void Processor::setTLBHi(unsigned int index, Word value) {
   assert(index < tlbSize);
   tlb[index].setHI(value);
+  flushMicroTLB();
   SignalTLBChanged(index);
 }
 
 void Processor::setTLBLo(unsigned int index, Word value) {
   assert(index < tlbSize);
   tlb[index].setLO(value);
+  flushMicroTLB();
   SignalTLBChanged(index);
 }
 
@@ -584,45 +993,43 @@ void Processor::setTLBLo(unsigned int index, Word value) {
 // This method advances CP0 RANDOM register, following MIPS conventions; it
 // cycles from RANDOMTOP to RANDOMBASE, one STEP less for each clock tick
 void Processor::randomRegTick() {
-  csrWrite(CSR_RANDOM, (csrRead(CSR_RANDOM) - RANDOMSTEP) &
-                           (((tlbSize - 1UL) << RNDIDXOFFS)));
-  if (csrRead(CSR_RANDOM) < RANDOMBASE)
-    csrWrite(csrRead(CSR_RANDOM), ((tlbSize - 1UL) << RNDIDXOFFS));
+  csrRandom = (csrRandom - RANDOMSTEP) & (((tlbSize - 1UL) << RNDIDXOFFS));
+  if (csrRandom < RANDOMBASE)
+    csrWrite(csrRandom, ((tlbSize - 1UL) << RNDIDXOFFS));
 }
 
 // This method pushes the KU/IE bit stacks in CP0 STATUS register to start
 // exception handling
 void Processor::pushKUIEStack() {
 
-  if (BitVal(csrRead(MSTATUS), MSTATUS_MIE_BIT)) {
-    csrWrite(MSTATUS, SetBit(csrRead(MSTATUS), MSTATUS_MPIE_BIT));
+  if (BitVal(csrMStatus, MSTATUS_MIE_BIT)) {
+    csrMStatus = SetBit(csrMStatus, MSTATUS_MPIE_BIT);
   } else
-    csrWrite(MSTATUS, ResetBit(csrRead(MSTATUS), MSTATUS_MPIE_BIT));
+    csrMStatus = ResetBit(csrMStatus, MSTATUS_MPIE_BIT);
 
-  csrWrite(MSTATUS, ResetBit(csrRead(MSTATUS), MSTATUS_MIE_BIT));
+  csrMStatus = ResetBit(csrMStatus, MSTATUS_MIE_BIT);
 
   // set machine mode
-  csrWrite(MSTATUS,
-           (csrRead(MSTATUS) & ~MSTATUS_MPP_MASK) | (mode << MSTATUS_MPP_BIT));
+  csrMStatus = (csrMStatus & ~MSTATUS_MPP_MASK) | (mode << MSTATUS_MPP_BIT);
   mode = 0x3;
 }
 
 // This method pops the KU/IE bit stacks in CP0 STATUS register to end
 // exception handling. It is invoked on RFE instruction execution
 void Processor::popKUIEStack() {
-  if (BitVal(csrRead(MSTATUS), MSTATUS_MPIE_BIT))
-    csrWrite(MSTATUS, SetBit(csrRead(MSTATUS), MSTATUS_MIE_BIT));
+  if (BitVal(csrMStatus, MSTATUS_MPIE_BIT))
+    csrMStatus = SetBit(csrMStatus, MSTATUS_MIE_BIT);
   else
-    csrWrite(MSTATUS, ResetBit(csrRead(MSTATUS), MSTATUS_MIE_BIT));
+    csrMStatus = ResetBit(csrMStatus, MSTATUS_MIE_BIT);
 
-  csrWrite(MSTATUS, ResetBit(csrRead(MSTATUS), MSTATUS_MPIE_BIT));
+  csrMStatus = ResetBit(csrMStatus, MSTATUS_MPIE_BIT);
 
-  if ((csrRead(MSTATUS) & MSTATUS_MPP_MASK) >> MSTATUS_MPP_BIT)
-    csrWrite(MSTATUS, ResetBit(csrRead(MSTATUS), MSTATUS_MPRV_BIT));
+  if ((csrMStatus & MSTATUS_MPP_MASK) >> MSTATUS_MPP_BIT)
+    csrMStatus = ResetBit(csrMStatus, MSTATUS_MPRV_BIT);
 
   // xPP is set to the least-privileged supported mode
-  mode = (csrRead(MSTATUS) & MSTATUS_MPP_MASK) >> MSTATUS_MPP_BIT;
-  csrWrite(MSTATUS, (csrRead(MSTATUS) & ~MSTATUS_MPP_MASK) | MSTATUS_MPP_U);
+  mode = (csrMStatus & MSTATUS_MPP_MASK) >> MSTATUS_MPP_BIT;
+  csrMStatus = (csrMStatus & ~MSTATUS_MPP_MASK) | MSTATUS_MPP_U;
 }
 
 // This method test for pending interrupts, checking global abilitation (IEc
@@ -631,9 +1038,9 @@ void Processor::popKUIEStack() {
 // otherwise, and sets CP0 registers if needed
 bool Processor::checkForInt() {
   // check if interrupts are enabled and pending
-  if (csrRead(MSTATUS) & MSTATUS_MIE_MASK && (csrRead(MIE) & csrRead(MIP))) {
+  if (csrMStatus & MSTATUS_MIE_MASK && (csrMIE & csrMIP)) {
     uint l = 0;
-    uint mip = csrRead(MIP);
+    uint mip = csrMIP;
     while (mip > 1) {
       mip >>= 1;
       l++;
@@ -651,7 +1058,7 @@ bool Processor::checkForInt() {
  */
 void Processor::suspend() {
   // if (!(cpreg[CAUSE] & CAUSE_IP_MASK))
-  if (!(csrRead(MIP)))
+  if (!csrMIP)
     setStatus(PS_IDLE);
 }
 
@@ -693,6 +1100,13 @@ void Processor::zapTLB() {
     tlb[i].setLO(0);
     SignalTLBChanged(i);
   }
+  flushMicroTLB();
+}
+
+// This method invalidates all the micro-TLB entries
+void Processor::flushMicroTLB() {
+  for (unsigned int i = 0; i < kMicroTLBSize; i++)
+    microTLB[i].tag = 0;
 }
 
 // This method allows to handle the delayed load slot: it provides to load
@@ -706,11 +1120,14 @@ void Processor::completeLoad() {}
 // have been raised) and FALSE if conversion has taken place: physical value
 // for address conversion is returned thru paddr pointer.
 // AccType details memory access type (READ/WRITE/EXECUTE)
+template <unsigned int F>
 bool Processor::mapVirtual(Word vaddr, Word *paddr, Word accType) {
   // SignalProcVAccess() is always done so it is possible
-  // to track accesses which produce exceptions
-  machine->HandleVMAccess(ENTRYHI_GET_ASID(csrRead(CSR_ENTRYHI)), vaddr,
-                          accType, this);
+  // to track accesses which produce exceptions (unless no stoppoints
+  // are set, see EF_WATCH)
+  if (F & EF_WATCH)
+    machine->HandleVMAccess(ENTRYHI_GET_ASID(csrEntryHi), vaddr,
+                            accType, this);
 
   // address validity and bounds check
   if (BADADDR(vaddr) ||
@@ -742,9 +1159,21 @@ bool Processor::mapVirtual(Word vaddr, Word *paddr, Word accType) {
   // The access is in user mode to user space, or in kernel mode
   // to KSEG0 or KUSEG spaces.
 
+  // Try the micro-TLB first: it only holds translations probeTLB()
+  // found valid, so on a hit only writes to clean frames need the
+  // slow path (which raises the exception)
+  Word tag = VPN(vaddr) | ASID(csrEntryHi) | 1UL;
+  MicroTLBEntry *mte = &microTLB[(vaddr >> 12) & (kMicroTLBSize - 1)];
+  if (mte->tag == tag && (accType != WRITE || BitVal(mte->lo, DBITPOS))) {
+    *paddr = PHADDR(vaddr, mte->lo);
+    return false;
+  }
+
   unsigned int index;
-  if (probeTLB(&index, csrRead(CSR_ENTRYHI), vaddr)) {
+  if (probeTLB(&index, csrEntryHi, vaddr)) {
     if (tlb[index].IsV()) {
+      mte->tag = tag;
+      mte->lo = tlb[index].getLO();
       if (accType != WRITE || tlb[index].IsD()) {
         // All OK
         *paddr = PHADDR(vaddr, tlb[index].getLO());
@@ -786,414 +1215,655 @@ bool Processor::mapVirtual(Word vaddr, Word *paddr, Word accType) {
 void Processor::setTLBRegs(Word vaddr) {
   // Note that ENTRYLO is left undefined!
   csrWrite(CSR_BADVADDR, vaddr);
-  csrWrite(CSR_ENTRYHI, VPN(vaddr) | ASID(csrRead(CSR_ENTRYHI)));
-}
-
-bool Processor::execInstrL(Word instr) {
-  DISASSMSG("\tI-type | ");
-  bool e = false;
-  int8_t rd = RD(instr);
-  int8_t rs1 = RS1(instr);
-  int16_t imm = I_IMM(instr);
-  imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-  uint8_t FUNC3 = FUNC3(instr);
-  Word read = 0;
-  Word vaddr = regRead(rs1) + imm, paddr = 0;
-
-  switch (FUNC3) {
-  case OP_LB: {
-    DISASSMSG("LB\n");
-    // just 8 bits
-    if (!mapVirtual(ALIGN(vaddr), &paddr, READ) &&
-        !this->bus->DataRead(paddr, &read, this)) {
-      regWrite(rd, signExtByte(read, BYTEPOS(vaddr)));
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  case OP_LH: {
-    DISASSMSG("LBH\n");
-    // just 16 bits
-    if (!mapVirtual(ALIGN(vaddr), &paddr, READ) &&
-        !this->bus->DataRead(paddr, &read, this)) {
-      regWrite(rd, signExtHWord(read, HWORDPOS(vaddr)));
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  case OP_LW: {
-    DISASSMSG("LW %s,%s(%x),%d\n", regName[rd], regName[rs1], regRead(rs1),
-              (Word)imm);
-    if (!mapVirtual(vaddr, &paddr, READ) &&
-        !this->bus->DataRead(paddr, &read, this)) {
-      regWrite(rd, read);
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  case OP_LBU: {
-    // just 8 bits
-    if (!mapVirtual(ALIGN(vaddr), &paddr, READ) &&
-        !this->bus->DataRead(paddr, &read, this)) {
-      DISASSMSG("LBU %s,%s(%x),%d -> %x\n", regName[rd], regName[rs1],
-                regRead(rs1), imm, read);
-      regWrite(rd, zExtByte(read, BYTEPOS(vaddr)));
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  case OP_LHU: {
-    // just 16 bits
-    if (!mapVirtual(ALIGN(vaddr), &paddr, READ) &&
-        !this->bus->DataRead(paddr, &read, this)) {
-      DISASSMSG("LHU\n");
-      regWrite(rd, zExtHWord(read, HWORDPOS(vaddr)));
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  default: {
-    SignalExc(EXC_II, 0);
-    e = true;
-    break;
-  }
-  }
-  return e;
+  csrEntryHi = VPN(vaddr) | ASID(csrEntryHi);
 }
 
-bool Processor::execInstrR(Word instr) {
-  DISASSMSG("\tR-type | ");
-  bool e = false;
-  int8_t rs1 = RS1(instr);
-  int8_t rs2 = RS2(instr);
-  uint8_t rd = RD(instr);
-  uint8_t FUNC7 = FUNC7(instr);
-  uint8_t FUNC3 = FUNC3(instr);
-  switch (FUNC3) {
-  /* 0x0 */
-  case OP_ADD_FUNC3: {
-    switch (FUNC7) {
-    case OP_ADD_FUNC7: {
-      DISASSMSG("ADD %s,%s(%x),%s(%x) -> %x\n", regName[rd], regName[rs1],
-                regRead(rs1), regName[rs2], regRead(rs2),
-                regRead(rs1) + regRead(rs2));
-      regWrite(rd, regRead(rs1) + regRead(rs2));
+// This method decodes the instruction word instr into di: operand fields
+// are extracted and immediates sign-extended once, and the handler that
+// executes the instruction is selected, so that further executions of the
+// same word only take a call through di->handler
+template <unsigned int F>
+void Processor::decodeInstr(Word instr, DecodedInstr *di) {
+  di->handler = &Processor::execIllegal<F>;
+  di->instr = instr;
+  di->rd = RD(instr);
+  di->rs1 = RS1(instr);
+  di->rs2 = RS2(instr);
+  di->imm = 0;
+  di->flags = 0;
+
+  switch (OPCODE(instr)) {
+  case OP_L: {
+    int16_t imm = I_IMM(instr);
+    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+    di->imm = imm;
+    di->flags = DecodedInstr::DI_LOAD;
+    switch (FUNC3(instr)) {
+    case OP_LB:
+      di->handler = &Processor::execLB<F>;
       break;
-    }
-    case OP_SUB_FUNC7: {
-      DISASSMSG("SUB %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) - regRead(rs2));
+    case OP_LH:
+      di->handler = &Processor::execLH<F>;
       break;
-    }
-    case OP_MUL_FUNC7: {
-      DISASSMSG("MUL %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) * regRead(rs2));
+    case OP_LW:
+      di->handler = &Processor::execLW<F>;
       break;
-    }
-    default: {
-      ERRORMSG("ADD not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    case OP_LBU:
+      di->handler = &Processor::execLBU<F>;
+      break;
+    case OP_LHU:
+      di->handler = &Processor::execLHU<F>;
       break;
-    }
     }
     break;
   }
+  case R_TYPE: {
+    uint8_t func7 = FUNC7(instr);
+    switch (FUNC3(instr)) {
+    /* 0x0 */
+    case OP_ADD_FUNC3:
+      if (func7 == OP_ADD_FUNC7)
+        di->handler = &Processor::execADD<F>;
+      else if (func7 == OP_SUB_FUNC7)
+        di->handler = &Processor::execSUB<F>;
+      else if (func7 == OP_MUL_FUNC7)
+        di->handler = &Processor::execMUL<F>;
+      break;
     /* 0x1 */
-  case OP_MULH_FUNC3 || OP_SLL_FUNC3: {
-    switch (FUNC7) {
-    case OP_MULH_FUNC7: {
-      SWord high = 0, low = 0;
-      SignMult(regRead(rs1), regRead(rs2), &high, &low);
-      DISASSMSG("MULH %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                regName[rs2], high);
-      regWrite(rd, high);
+    case OP_MULH_FUNC3 || OP_SLL_FUNC3:
+      if (func7 == OP_MULH_FUNC7)
+        di->handler = &Processor::execMULH<F>;
+      else if (func7 == OP_SLL_FUNC7)
+        di->handler = &Processor::execSLL<F>;
       break;
-    }
-    case OP_SLL_FUNC7: {
-      DISASSMSG("SLL %s(%x),%s(%x),%d\n", regName[rd], regRead(rd),
-                regName[rs1], regRead(rs1), regRead(rs2));
-      regWrite(rd, regRead(rs1) << regRead(rs2));
+    /* 0x2 */
+    case OP_MULHSU_FUNC3 | OP_SLT_FUNC3:
+      if (func7 == OP_MULHSU_FUNC7)
+        di->handler = &Processor::execMULHSU<F>;
+      else if (func7 == OP_SLT_FUNC7)
+        di->handler = &Processor::execSLT<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    /* 0x3 */
+    case OP_MULHU_FUNC3 | OP_SLTU_FUNC3:
+      if (func7 == OP_MULHU_FUNC7)
+        di->handler = &Processor::execMULHU<F>;
+      else if (func7 == OP_SLTU_FUNC7)
+        di->handler = &Processor::execSLTU<F>;
       break;
-    }
-    }
-    break;
-  }
-    /* 0x2 */
-  case OP_MULHSU_FUNC3 | OP_SLT_FUNC3: {
-    switch (FUNC7) {
-    case OP_MULHSU_FUNC7: {
-      SWord high = 0, low = 0;
-      UnsSignMult((SWord)regRead(rs1), (SWord)regRead(rs2), &high, &low);
-      DISASSMSG("MULHSU %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                regName[rs2], high);
-      regWrite(rd, high);
+    /* 0x4 */
+    case OP_DIV_FUNC3 | OP_XOR_FUNC3:
+      if (func7 == OP_DIV_FUNC7)
+        di->handler = &Processor::execDIV<F>;
+      else if (func7 == OP_XOR_FUNC7)
+        di->handler = &Processor::execXOR<F>;
       break;
-    }
-    case OP_SLT_FUNC7: {
-      DISASSMSG("SLT %s(%x),%s(%x),%d\n", regName[rd], regRead(rd),
-                regName[rs1], regRead(rs1), regRead(rs2));
-      regWrite(rd, SWord(regRead(rs1)) < SWord(regRead(rs2)) ? 1 : 0);
+    /* 0x5 */
+    case OP_DIVU_FUNC3 | OP_SRL_FUNC3 | OP_SRA_FUNC3:
+      if (func7 == OP_DIVU_FUNC7)
+        di->handler = &Processor::execDIVU<F>;
+      else if (func7 == OP_SRA_FUNC7)
+        di->handler = &Processor::execSRA<F>;
+      else if (func7 == OP_SRL_FUNC7)
+        di->handler = &Processor::execSRL<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    /* 0x6 */
+    case OP_REM_FUNC3 | OP_OR_FUNC3:
+      if (func7 == OP_REM_FUNC7)
+        di->handler = &Processor::execREM<F>;
+      else if (func7 == OP_OR_FUNC7)
+        di->handler = &Processor::execOR<F>;
+      break;
+    /* 0x7 */
+    case OP_REMU_FUNC3 | OP_AND_FUNC3:
+      if (func7 == OP_REMU_FUNC7)
+        di->handler = &Processor::execREMU<F>;
+      else if (func7 == OP_AND_FUNC7)
+        di->handler = &Processor::execAND<F>;
       break;
-    }
     }
     break;
   }
-    /* 0x3 */
-  case OP_MULHU_FUNC3 | OP_SLTU_FUNC3: {
-    switch (FUNC7) {
-    case OP_MULHU_FUNC7: {
-      Word high = 0, low = 0;
-      UnsMult(regRead(rs1), regRead(rs2), &high, &low);
-      DISASSMSG("MULHU %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                regName[rs2], high);
-      regWrite(rd, high);
+  case I_TYPE: {
+    // shift amounts are used as they are, all the others sign-extended
+    SWord imm = I_IMM(instr);
+    switch (FUNC3(instr)) {
+    case OP_ADDI:
+      di->handler = &Processor::execADDI<F>;
       break;
-    }
-    case OP_SLTU_FUNC7: {
-      DISASSMSG("SLTU %s(%x),%s(%x),%d\n", regName[rd], regRead(rd),
-                regName[rs1], regRead(rs1), regRead(rs2));
-      regWrite(rd, Word(regRead(rs1)) < Word(regRead(rs2)) ? 1 : 0);
+    case OP_SLLI:
+      di->handler = &Processor::execSLLI<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    case OP_SLTI:
+      di->handler = &Processor::execSLTI<F>;
       break;
-    }
-    }
-    break;
-  }
-    /* 0x4 */
-  case OP_DIV_FUNC3 | OP_XOR_FUNC3: {
-    switch (FUNC7) {
-    case OP_DIV_FUNC7: {
-      if (regRead(rs2) != 0) {
-        Word r = (Word)regRead(rs1) / (Word)regRead(rs2);
-        DISASSMSG("DIV %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                  regName[rs2], r);
-        regWrite(rd, r);
-      } else {
-        ERRORMSG("Division by zero detected");
-      }
+    case OP_SLTIU:
+      di->handler = &Processor::execSLTIU<F>;
       break;
-    }
-    case OP_XOR_FUNC7: {
-      DISASSMSG("XOR %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) ^ regRead(rs2));
+    case OP_XORI:
+      di->handler = &Processor::execXORI<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    case OP_SR:
+      if (FUNC7(instr) == OP_SRLI_FUNC7)
+        di->handler = &Processor::execSRLI<F>;
+      else if (FUNC7(instr) == OP_SRAI_FUNC7)
+        di->handler = &Processor::execSRAI<F>;
+      break;
+    case OP_ORI:
+      di->handler = &Processor::execORI<F>;
+      break;
+    case OP_ANDI:
+      di->handler = &Processor::execANDI<F>;
       break;
     }
-    }
+    if (FUNC3(instr) != OP_SLLI && FUNC3(instr) != OP_SR)
+      imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+    di->imm = imm;
     break;
   }
-    /* 0x5 */
-  case OP_DIVU_FUNC3 | OP_SRL_FUNC3 | OP_SRA_FUNC3: {
-    switch (FUNC7) {
-    case OP_DIVU_FUNC7: {
-      if (regRead(rs2) != 0) {
-        SWord r = (SWord)regRead(rs1) / (SWord)regRead(rs2);
-        DISASSMSG("DIVU %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                  regName[rs2], r);
-        regWrite(rd, r);
-      }
+  case I2_TYPE: {
+    di->handler = &Processor::execInstrI2<F>;
+    break;
+  }
+  case B_TYPE: {
+    int16_t imm = B_IMM(instr);
+    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
+    di->imm = imm;
+    di->flags = DecodedInstr::DI_BRANCH;
+    switch (FUNC3(instr)) {
+    case OP_BEQ:
+      di->handler = &Processor::execBEQ<F>;
       break;
-    }
-    case OP_SRA_FUNC7: {
-      DISASSMSG("SRA %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      uint8_t msb = rs1 & 0x80000000;
-      regWrite(rd, regRead(rs1) >> regRead(rs2) | msb);
-      regWrite(rd, regRead(rs1) ^ regRead(rs2));
+    case OP_BNE:
+      di->handler = &Processor::execBNE<F>;
       break;
-    }
-    case OP_SRL_FUNC7: {
-      DISASSMSG("SRL %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) >> regRead(rs2));
+    case OP_BLT:
+      di->handler = &Processor::execBLT<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    case OP_BGE:
+      di->handler = &Processor::execBGE<F>;
+      break;
+    case OP_BLTU:
+      di->handler = &Processor::execBLTU<F>;
+      break;
+    case OP_BGEU:
+      di->handler = &Processor::execBGEU<F>;
       break;
-    }
     }
     break;
   }
-    /* 0x6 */
-  case OP_REM_FUNC3 | OP_OR_FUNC3: {
-    switch (FUNC7) {
-    case OP_REM_FUNC7: {
-      if (regRead(rs2) != 0) {
-        SWord r = (SWord)regRead(rs1) % (SWord)regRead(rs2);
-        DISASSMSG("REM %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                  regName[rs2], r);
-        regWrite(rd, r);
-      }
+  case S_TYPE: {
+    int16_t imm = S_IMM(instr);
+    imm = SIGN_EXTENSION(imm, S_IMM_SIZE);
+    di->imm = imm;
+    di->flags = DecodedInstr::DI_STORE;
+    switch (FUNC3(instr)) {
+    case OP_SB:
+      di->handler = &Processor::execSB<F>;
       break;
-    }
-    case OP_OR_FUNC7: {
-      DISASSMSG("OR %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) | regRead(rs2));
+    case OP_SH:
+      di->handler = &Processor::execSH<F>;
       break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
+    case OP_SW:
+      di->handler = &Processor::execSW<F>;
       break;
     }
-    }
     break;
   }
-    /* 0x7 */
-  case OP_REMU_FUNC3 | OP_AND_FUNC3: {
-    switch (FUNC7) {
-    case OP_REMU_FUNC7: {
-      if (regRead(rs2) != 0) {
-        Word r = (Word)regRead(rs1) % (Word)regRead(rs2);
-        DISASSMSG("REMU %s,%s,%s -> %x\n", regName[rd], regName[rs1],
-                  regName[rs2], r);
-        regWrite(rd, r);
-      }
-      break;
-    }
-    case OP_AND_FUNC7: {
-      DISASSMSG("AND %s,%s,%s\n", regName[rd], regName[rs1], regName[rs2]);
-      regWrite(rd, regRead(rs1) & regRead(rs2));
-      break;
-    }
-    default: {
-      ERRORMSG("R-type not recognized (%x)\n", FUNC7);
-      SignalExc(EXC_II, 0);
-      e = true;
-      break;
-    }
-    }
-    break;
-  }
-  default: {
-    SignalExc(EXC_II, 0);
-    e = true;
-    break;
-  }
-  }
-  setNextPC(getPC() + WORDLEN);
-  return e;
-}
-
-bool Processor::execInstrI(Word instr) {
-  DISASSMSG("\tI-type | ");
-  bool e = false;
-  int8_t rs1 = RS1(instr);
-  SWord imm = I_IMM(instr);
-  uint8_t rd = RD(instr);
-  uint8_t FUNC3 = FUNC3(instr);
-
-  switch (FUNC3) {
-  case OP_ADDI: {
+  case OP_AUIPC: {
+    SWord imm = U_IMM(instr);
     imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    DISASSMSG("ADDI %s,%s(%x),%d\n", regName[rd], regName[rs1], regRead(rs1),
-              imm);
-    regWrite(rd, (Word)(regRead(rs1) + imm));
+    di->imm = imm;
+    di->handler = &Processor::execAUIPC<F>;
     break;
   }
-  case OP_SLLI: {
-    DISASSMSG("SLLI %s(%x),%s(%x),%d\n", regName[rd], regRead(rd), regName[rs1],
-              regRead(rs1), imm);
-    regWrite(rd, regRead(rs1) << imm);
+  case OP_LUI: {
+    di->imm = SIGN_EXTENSION(U_IMM(instr), U_IMM_SIZE) << 12;
+    di->handler = &Processor::execLUI<F>;
     break;
   }
-  case OP_SLTI: {
-    DISASSMSG("SLTI\n");
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    regWrite(rd, SWord(regRead(rs1)) < SWord(imm) ? 1 : 0);
+  case OP_JAL: {
+    di->imm = SIGN_EXTENSION(J_IMM(instr), J_IMM_SIZE) & 0xfffffffe;
+    di->handler = &Processor::execJAL<F>;
+    di->flags = DecodedInstr::DI_BRANCH;
     break;
   }
-  case OP_SLTIU: {
-    DISASSMSG("SLTIU\n");
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    regWrite(rd, regRead(rs1) < Word(imm) ? 1 : 0);
+  case OP_JALR: {
+    di->imm = SIGN_EXTENSION(I_IMM(instr), I_IMM_SIZE);
+    di->handler = &Processor::execJALR<F>;
+    di->flags = DecodedInstr::DI_BRANCH;
     break;
   }
-  case OP_XORI: {
-    DISASSMSG("XORI\n");
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    regWrite(rd, SWord(regRead(rs1)) ^ SWord(imm));
-    break;
   }
-  case OP_SR: {
-    uint8_t FUNC7 = FUNC7(instr);
-    switch (FUNC7) {
-    case OP_SRLI_FUNC7: {
-      DISASSMSG("SRLI %s,%s(%x),%x\n", regName[rd], regName[rs1], regRead(rs1),
-                imm);
-      regWrite(rd, regRead(rs1) >> imm);
-      break;
-    }
-    case OP_SRAI_FUNC7: {
-      DISASSMSG("SRAI %s,%s(%x),%x\n", regName[rd], regName[rs1], regRead(rs1),
-                imm);
-      uint8_t msb = rs1 & 0x80000000;
-      regWrite(rd, regRead(rs1) >> imm | msb);
-      break;
+
+  if (di->handler == &Processor::execIllegal<F> ||
+      di->handler == &Processor::execInstrI2<F>)
+    di->flags = DecodedInstr::DI_SYSTEM;
+}
+
+// This method make Processor execute a single instruction (the one in
+// currInstr, fetched from currPhysPC). Decoded instructions are kept in
+// the bus-wide decode cache, so the instruction word is decoded only the
+// first time it is executed after being loaded in memory.
+template <unsigned int F> bool Processor::execInstr() {
+  // const Symbol *sym =
+  //     machine->getStab()->Probe(config->getSymbolTableASID(), getPC(), true);
+  // if (sym != NULL && sym->getName() != prevFunc) {
+  //   DISASSMSG("<FUN %s\n", prevFunc.c_str());
+  //   prevFunc = sym->getName();
+  //   DISASSMSG("\n>FUN %s\n", sym->getName());
+  // }
+  // DISASSMSG("[%08x] (%08x) ", getPC(), instr);
+
+  DecodedInstr *di = decodeCache->Lookup(currPhysPC);
+  if (di->handler == NULL) {
+    // The word in memory may have changed since currInstr was fetched
+    // (e.g. overwritten by a DMA transfer): the instruction is executed
+    // anyway, but not cached
+    Word word;
+    if (bus->InstrReadGDB(currPhysPC, &word, this) || word != currInstr) {
+      DecodedInstr tmp;
+      decodeInstr<F>(currInstr, &tmp);
+      return (this->*tmp.handler)(&tmp);
     }
-    default:
-      SignalExc(EXC_II, 0);
-      e = true;
-      break;
+    decodeInstr<F>(currInstr, di);
+  }
+  return (this->*di->handler)(di);
+}
+
+// This method handles instruction words that do not encode a known
+// instruction, raising an Illegal Instruction exception; messages and PC
+// updates follow the instruction format, as decoding would have
+template <unsigned int F>
+bool Processor::execIllegal(const DecodedInstr *di) {
+  switch (OPCODE(di->instr)) {
+  case R_TYPE:
+    TRACEMSG("\tR-type | ");
+    if (FUNC3(di->instr) == OP_ADD_FUNC3) {
+      ERRORMSG("ADD not recognized (%x)\n", FUNC7(di->instr));
+    } else {
+      ERRORMSG("R-type not recognized (%x)\n", FUNC7(di->instr));
     }
+    SignalExc(EXC_II, 0);
+    setNextPC(getPC() + WORDLEN);
     break;
-  }
-  case OP_ORI: {
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    DISASSMSG("ORI %s,%s(%x),%x\n", regName[rd], regName[rs1], regRead(rs1),
-              imm);
-    regWrite(rd, SWord(regRead(rs1)) | SWord(imm));
+  case I_TYPE:
+    TRACEMSG("\tI-type | ");
+    SignalExc(EXC_II, 0);
+    setNextPC(getPC() + WORDLEN);
     break;
-  }
-  case OP_ANDI: {
-    DISASSMSG("ANDI %s,%s(%x),%x\n", regName[rd], regName[rs1], regRead(rs1),
-              imm);
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    regWrite(rd, SWord(regRead(rs1)) & SWord(imm));
+  case OP_L:
+    TRACEMSG("\tI-type | ");
+    SignalExc(EXC_II, 0);
     break;
-  }
-  default: {
+  case B_TYPE:
+    TRACEMSG("\tB-type | ");
+    SignalExc(EXC_II, 0);
+    break;
+  case S_TYPE:
+    TRACEMSG("\tS-type | ");
     SignalExc(EXC_II, 0);
-    e = true;
     break;
+  default:
+    ERRORMSG("OpCode not handled %x\n", di->instr);
+    SignalExc(EXC_II, 0);
+    ERROR("opcode not handled");
+  }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execLB(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | LB\n");
+  Word vaddr = regRead(di->rs1) + di->imm, paddr = 0;
+  Word read = 0;
+  // just 8 bits
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, READ) &&
+      !this->bus->DataRead(paddr, &read, this)) {
+    regWrite(di->rd, signExtByte(read, BYTEPOS(vaddr)));
+    setNextPC(getPC() + WORDLEN);
+    return false;
+  }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execLH(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | LBH\n");
+  Word vaddr = regRead(di->rs1) + di->imm, paddr = 0;
+  Word read = 0;
+  // just 16 bits
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, READ) &&
+      !this->bus->DataRead(paddr, &read, this)) {
+    regWrite(di->rd, signExtHWord(read, HWORDPOS(vaddr)));
+    setNextPC(getPC() + WORDLEN);
+    return false;
+  }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execLW(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | LW %s,%s(%x),%d\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), (Word)di->imm);
+  Word vaddr = regRead(di->rs1) + di->imm, paddr = 0;
+  Word read = 0;
+  if (!mapVirtual<F>(vaddr, &paddr, READ) &&
+      !this->bus->DataRead(paddr, &read, this)) {
+    regWrite(di->rd, read);
+    setNextPC(getPC() + WORDLEN);
+    return false;
   }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execLBU(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | ");
+  Word vaddr = regRead(di->rs1) + di->imm, paddr = 0;
+  Word read = 0;
+  // just 8 bits
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, READ) &&
+      !this->bus->DataRead(paddr, &read, this)) {
+    TRACEMSG("LBU %s,%s(%x),%d -> %x\n", regName[di->rd], regName[di->rs1],
+             regRead(di->rs1), di->imm, read);
+    regWrite(di->rd, zExtByte(read, BYTEPOS(vaddr)));
+    setNextPC(getPC() + WORDLEN);
+    return false;
   }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execLHU(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | ");
+  Word vaddr = regRead(di->rs1) + di->imm, paddr = 0;
+  Word read = 0;
+  // just 16 bits
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, READ) &&
+      !this->bus->DataRead(paddr, &read, this)) {
+    TRACEMSG("LHU\n");
+    regWrite(di->rd, zExtHWord(read, HWORDPOS(vaddr)));
+    setNextPC(getPC() + WORDLEN);
+    return false;
+  }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execADD(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | ADD %s,%s(%x),%s(%x) -> %x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), regName[di->rs2],
+           regRead(di->rs2), regRead(di->rs1) + regRead(di->rs2));
+  regWrite(di->rd, regRead(di->rs1) + regRead(di->rs2));
   setNextPC(getPC() + WORDLEN);
-  return e;
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSUB(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SUB %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) - regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execMUL(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | MUL %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) * regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execMULH(const DecodedInstr *di) {
+  SWord high = 0, low = 0;
+  SignMult(regRead(di->rs1), regRead(di->rs2), &high, &low);
+  TRACEMSG("\tR-type | MULH %s,%s,%s -> %x\n", regName[di->rd],
+           regName[di->rs1], regName[di->rs2], high);
+  regWrite(di->rd, high);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLL(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SLL %s(%x),%s(%x),%d\n", regName[di->rd],
+           regRead(di->rd), regName[di->rs1], regRead(di->rs1),
+           regRead(di->rs2));
+  regWrite(di->rd, regRead(di->rs1) << regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execMULHSU(const DecodedInstr *di) {
+  SWord high = 0, low = 0;
+  UnsSignMult((SWord)regRead(di->rs1), (SWord)regRead(di->rs2), &high, &low);
+  TRACEMSG("\tR-type | MULHSU %s,%s,%s -> %x\n", regName[di->rd],
+           regName[di->rs1], regName[di->rs2], high);
+  regWrite(di->rd, high);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLT(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SLT %s(%x),%s(%x),%d\n", regName[di->rd],
+           regRead(di->rd), regName[di->rs1], regRead(di->rs1),
+           regRead(di->rs2));
+  regWrite(di->rd, SWord(regRead(di->rs1)) < SWord(regRead(di->rs2)) ? 1 : 0);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execMULHU(const DecodedInstr *di) {
+  Word high = 0, low = 0;
+  UnsMult(regRead(di->rs1), regRead(di->rs2), &high, &low);
+  TRACEMSG("\tR-type | MULHU %s,%s,%s -> %x\n", regName[di->rd],
+           regName[di->rs1], regName[di->rs2], high);
+  regWrite(di->rd, high);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLTU(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SLTU %s(%x),%s(%x),%d\n", regName[di->rd],
+           regRead(di->rd), regName[di->rs1], regRead(di->rs1),
+           regRead(di->rs2));
+  regWrite(di->rd, Word(regRead(di->rs1)) < Word(regRead(di->rs2)) ? 1 : 0);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execDIV(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | ");
+  if (regRead(di->rs2) != 0) {
+    Word r = (Word)regRead(di->rs1) / (Word)regRead(di->rs2);
+    TRACEMSG("DIV %s,%s,%s -> %x\n", regName[di->rd], regName[di->rs1],
+             regName[di->rs2], r);
+    regWrite(di->rd, r);
+  } else {
+    ERRORMSG("Division by zero detected");
+  }
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execXOR(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | XOR %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) ^ regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execDIVU(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | ");
+  if (regRead(di->rs2) != 0) {
+    SWord r = (SWord)regRead(di->rs1) / (SWord)regRead(di->rs2);
+    TRACEMSG("DIVU %s,%s,%s -> %x\n", regName[di->rd], regName[di->rs1],
+             regName[di->rs2], r);
+    regWrite(di->rd, r);
+  }
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSRA(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SRA %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  uint8_t msb = di->rs1 & 0x80000000;
+  regWrite(di->rd, regRead(di->rs1) >> regRead(di->rs2) | msb);
+  regWrite(di->rd, regRead(di->rs1) ^ regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSRL(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | SRL %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) >> regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execREM(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | ");
+  if (regRead(di->rs2) != 0) {
+    SWord r = (SWord)regRead(di->rs1) % (SWord)regRead(di->rs2);
+    TRACEMSG("REM %s,%s,%s -> %x\n", regName[di->rd], regName[di->rs1],
+             regName[di->rs2], r);
+    regWrite(di->rd, r);
+  }
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execOR(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | OR %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) | regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execREMU(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | ");
+  if (regRead(di->rs2) != 0) {
+    Word r = (Word)regRead(di->rs1) % (Word)regRead(di->rs2);
+    TRACEMSG("REMU %s,%s,%s -> %x\n", regName[di->rd], regName[di->rs1],
+             regName[di->rs2], r);
+    regWrite(di->rd, r);
+  }
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execAND(const DecodedInstr *di) {
+  TRACEMSG("\tR-type | AND %s,%s,%s\n", regName[di->rd], regName[di->rs1],
+           regName[di->rs2]);
+  regWrite(di->rd, regRead(di->rs1) & regRead(di->rs2));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execADDI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | ADDI %s,%s(%x),%d\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), di->imm);
+  regWrite(di->rd, (Word)(regRead(di->rs1) + di->imm));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLLI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | SLLI %s(%x),%s(%x),%d\n", regName[di->rd],
+           regRead(di->rd), regName[di->rs1], regRead(di->rs1), di->imm);
+  regWrite(di->rd, regRead(di->rs1) << di->imm);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLTI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | SLTI\n");
+  regWrite(di->rd, SWord(regRead(di->rs1)) < SWord(di->imm) ? 1 : 0);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSLTIU(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | SLTIU\n");
+  regWrite(di->rd, regRead(di->rs1) < Word(di->imm) ? 1 : 0);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execXORI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | XORI\n");
+  regWrite(di->rd, SWord(regRead(di->rs1)) ^ SWord(di->imm));
+  setNextPC(getPC() + WORDLEN);
+  return false;
 }
 
-bool Processor::execInstrI2(Word instr) {
-  DISASSMSG("\tI2-type | ");
+template <unsigned int F>
+bool Processor::execSRLI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | SRLI %s,%s(%x),%x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), di->imm);
+  regWrite(di->rd, regRead(di->rs1) >> di->imm);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execSRAI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | SRAI %s,%s(%x),%x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), di->imm);
+  uint8_t msb = di->rs1 & 0x80000000;
+  regWrite(di->rd, regRead(di->rs1) >> di->imm | msb);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execORI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | ORI %s,%s(%x),%x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), di->imm);
+  regWrite(di->rd, SWord(regRead(di->rs1)) | SWord(di->imm));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execANDI(const DecodedInstr *di) {
+  TRACEMSG("\tI-type | ANDI %s,%s(%x),%x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1), I_IMM(di->instr));
+  regWrite(di->rd, SWord(regRead(di->rs1)) & SWord(di->imm));
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execInstrI2(const DecodedInstr *di) {
+  Word instr = di->instr;
+  TRACEMSG("\tI2-type | ");
   Word e = NOEXCEPTION;
   uint16_t imm = I_IMM(instr);
   int8_t rs1 = RS1(instr);
@@ -1207,7 +1877,7 @@ bool Processor::execInstrI2(Word instr) {
       // a7 - syscall number
       // a0 - result of syscall
       //
-      DISASSMSG("ECALL %d\n", regRead(REG_A0));
+      TRACEMSG("ECALL %d\n", regRead(REG_A0));
       setNextPC(getPC() + WORDLEN);
       // only M or U modes are possible
       if (mode == 0x3)
@@ -1219,7 +1889,7 @@ bool Processor::execInstrI2(Word instr) {
     }
     case EBREAK_IMM: {
       int mode = regRead(REG_A0);
-      DISASSMSG("EBREAK\n");
+      TRACEMSG("EBREAK\n");
       if (mode == BIOS_SRV_PANIC)
         exit(0);
       if (mode <= BIOS_SRV_HALT) {
@@ -1230,31 +1900,33 @@ bool Processor::execInstrI2(Word instr) {
         switch (mode) {
         case BIOS_SRV_TLBP:
           // solution "by the book"
-          DISASSMSG(" TLBP\n");
+          TRACEMSG(" TLBP\n");
           csrWrite(CSR_INDEX, SIGNMASK);
-          if (probeTLB(&i, csrRead(CSR_ENTRYHI), csrRead(CSR_ENTRYHI)))
+          if (probeTLB(&i, csrEntryHi, csrEntryHi))
             csrWrite(CSR_INDEX, (i << RNDIDXOFFS));
           break;
 
         case BIOS_SRV_TLBR:
-          DISASSMSG(" TLBR\n");
-          csrWrite(CSR_ENTRYHI, tlb[RNDIDX(csrRead(CSR_INDEX))].getHI());
+          TRACEMSG(" TLBR\n");
+          csrEntryHi = tlb[RNDIDX(csrRead(CSR_INDEX))].getHI();
           csrWrite(CSR_ENTRYLO, tlb[RNDIDX(csrRead(CSR_INDEX))].getLO());
           break;
 
         case BIOS_SRV_TLBWI:
-          DISASSMSG(" TLBWI\n");
-          tlb[RNDIDX(csrRead(CSR_INDEX))].setHI(csrRead(CSR_ENTRYHI));
+          TRACEMSG(" TLBWI\n");
+          tlb[RNDIDX(csrRead(CSR_INDEX))].setHI(csrEntryHi);
           tlb[RNDIDX(csrRead(CSR_INDEX))].setLO(csrRead(CSR_ENTRYLO));
+          flushMicroTLB();
           SignalTLBChanged(RNDIDX(csrRead(CSR_INDEX)));
           break;
 
         case BIOS_SRV_TLBWR:
-          DISASSMSG(" TLBWR\n");
-          tlb[RNDIDX(csrRead(CSR_RANDOM))].setHI(csrRead(CSR_ENTRYHI));
-          tlb[RNDIDX(csrRead(CSR_RANDOM))].setLO(csrRead(CSR_ENTRYLO));
-          DISASSMSG("\n\nENTRYHI %x\n", csrRead(CSR_ENTRYHI));
-          DISASSMSG("ENTRYLO %x\n\n", csrRead(CSR_ENTRYLO));
+          TRACEMSG(" TLBWR\n");
+          tlb[RNDIDX(csrRandom)].setHI(csrEntryHi);
+          tlb[RNDIDX(csrRandom)].setLO(csrRead(CSR_ENTRYLO));
+          flushMicroTLB();
+          TRACEMSG("\n\nENTRYHI %x\n", csrEntryHi);
+          TRACEMSG("ENTRYLO %x\n\n", csrRead(CSR_ENTRYLO));
           SignalTLBChanged(RNDIDX(csrRead(CSR_INDEX)));
           break;
 
@@ -1281,13 +1953,13 @@ bool Processor::execInstrI2(Word instr) {
        Section 3.1.6.1, xRET sets the pc to the value stored in the xepc
        register.
       */
-      DISASSMSG("MRET %x\n", csrRead(MEPC));
+      TRACEMSG("MRET %x\n", csrRead(MEPC));
       popKUIEStack();
       setNextPC(csrRead(MEPC));
       break;
     }
     case EWFI_IMM: {
-      DISASSMSG("EWFI\n");
+      TRACEMSG("EWFI\n");
       setNextPC(getPC() + WORDLEN);
       suspend();
       break;
@@ -1302,8 +1974,8 @@ bool Processor::execInstrI2(Word instr) {
     break;
   }
   case OP_CSRRW: {
-    DISASSMSG("CSRRW %s(%x),%s(%x),%x\n", regName[rd], regRead(rd),
-              regName[rs1], regRead(rs1), imm);
+    TRACEMSG("CSRRW %s(%x),%s(%x),%x\n", regName[rd], regRead(rd),
+             regName[rs1], regRead(rs1), imm);
     if (rd != REG_ZERO)
       regWrite(rd, csrRead(imm));
     if (rs1 != REG_ZERO) {
@@ -1371,220 +2043,155 @@ bool Processor::execInstrI2(Word instr) {
   return e;
 }
 
-bool Processor::execInstrB(Word instr) {
-  DISASSMSG("\tB-type | ");
-  Word e = NOEXCEPTION;
-  int8_t rs1 = RS1(instr);
-  int8_t rs2 = RS2(instr);
-  int16_t imm = B_IMM(instr);
-  imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-  uint8_t FUNC3 = FUNC3(instr);
+template <unsigned int F>
+bool Processor::execBEQ(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BEQ %s(%x),%s(%x),%d\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm);
+  if ((SWord)regRead(di->rs1) == (SWord)regRead(di->rs2))
+    setNextPC((SWord)getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
+}
 
-  switch (FUNC3) {
-  case OP_BEQ: {
-    DISASSMSG("BEQ %s(%x),%s(%x),%d\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm);
-    if ((SWord)regRead(rs1) == (SWord)regRead(rs2))
-      setNextPC((SWord)getPC() + ((SWord)imm));
-    else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_BNE: {
-    DISASSMSG("BNE %s(%x),%s(%x),%d\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm);
-    if ((SWord)regRead(rs1) != (SWord)regRead(rs2))
-      setNextPC((SWord)getPC() + ((SWord)imm));
-    else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_BLT: {
-    DISASSMSG("BLT %s(%x),%s(%x),%d (%d)\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm, regRead(rs1) < regRead(rs2));
-    if ((SWord)regRead(rs1) < (SWord)regRead(rs2))
-      setNextPC((SWord)getPC() + ((SWord)imm));
-    else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_BGE: {
-    DISASSMSG("BGE %s(%x),%s(%x),%d\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm);
-    if ((SWord)regRead(rs1) >= (SWord)regRead(rs2)) {
-      setNextPC((SWord)getPC() + ((SWord)imm));
-    } else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_BLTU: {
-    DISASSMSG("BLTU %s(%x),%s(%x),%d\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm);
-    if (regRead(rs1) < regRead(rs2))
-      setNextPC(getPC() + (imm));
-    else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_BGEU: {
-    DISASSMSG("BGEU %s(%x),%s(%x),%d\n", regName[rs1], regRead(rs1),
-              regName[rs2], regRead(rs2), imm);
-    if (regRead(rs1) >= regRead(rs2))
-      setNextPC(getPC() + (imm));
-    else
-      setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  default: {
-    SignalExc(EXC_II, 0);
-    e = true;
-    break;
-  }
-  }
-  return e;
+template <unsigned int F>
+bool Processor::execBNE(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BNE %s(%x),%s(%x),%d\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm);
+  if ((SWord)regRead(di->rs1) != (SWord)regRead(di->rs2))
+    setNextPC((SWord)getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
 }
 
-bool Processor::execInstrS(Word instr) {
-  DISASSMSG("\tS-type | ");
-  Word e = NOEXCEPTION;
-  int8_t rs1 = RS1(instr);
-  int8_t rs2 = RS2(instr);
-  int16_t imm = S_IMM(instr);
-  imm = SIGN_EXTENSION(imm, S_IMM_SIZE);
-  uint8_t FUNC3 = FUNC3(instr);
-  Word vaddr = (SWord)regRead(rs1) + (SWord)imm;
-  Word paddr = 0;
-  Word old = 0;
+template <unsigned int F>
+bool Processor::execBLT(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BLT %s(%x),%s(%x),%d (%d)\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm,
+           regRead(di->rs1) < regRead(di->rs2));
+  if ((SWord)regRead(di->rs1) < (SWord)regRead(di->rs2))
+    setNextPC((SWord)getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
+}
 
-  switch (FUNC3) {
-  case OP_SB: {
-    DISASSMSG("SB %s(%x),%s(%x),%d\n", regName[rs2], regRead(rs2), regName[rs1],
-              regRead(rs1), imm);
-    if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) &&
-        !bus->DataRead(paddr, &old, this)) {
-      old = mergeByte(old, regRead(rs2), BYTEPOS(vaddr));
-      e = this->bus->DataWrite(paddr, old, this);
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
+template <unsigned int F>
+bool Processor::execBGE(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BGE %s(%x),%s(%x),%d\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm);
+  if ((SWord)regRead(di->rs1) >= (SWord)regRead(di->rs2))
+    setNextPC((SWord)getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
+}
 
-    break;
-  }
-  case OP_SH: {
-    DISASSMSG("SH %s(%x),%s(%x),%d -> %x\n", regName[rs2], regRead(rs2),
-              regName[rs1], regRead(rs1), imm, old);
-    if (!mapVirtual(ALIGN(vaddr), &paddr, WRITE) &&
-        !bus->DataRead(paddr, &old, this)) {
-      old = mergeHWord(old, regRead(rs2), HWORDPOS(vaddr));
-      e = this->bus->DataWrite(paddr, old, this);
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  case OP_SW: {
-    DISASSMSG("SW $(%s(%x)+%d)<-%s(%x)\n", regName[rs1], regRead(rs1), imm,
-              regName[rs2], regRead(rs2));
-    if (!mapVirtual(vaddr, &paddr, WRITE) &&
-        !this->bus->DataWrite(paddr, regRead(rs2), this)) {
-      setNextPC(getPC() + WORDLEN);
-    } else
-      e = true;
-    break;
-  }
-  default: {
-    SignalExc(EXC_II, 0);
-    e = true;
-    break;
-  }
-  }
-  return e;
+template <unsigned int F>
+bool Processor::execBLTU(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BLTU %s(%x),%s(%x),%d\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm);
+  if (regRead(di->rs1) < regRead(di->rs2))
+    setNextPC(getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
 }
 
-// This method make Processor execute a single MIPS instruction, emulating
-// pipeline constraints and load delay slots (see external doc).
-bool Processor::execInstr(Word instr) {
-  Word e = NOEXCEPTION;
-  uint8_t opcode = OPCODE(instr);
-  // const Symbol *sym =
-  //     machine->getStab()->Probe(config->getSymbolTableASID(), getPC(), true);
-  // if (sym != NULL && sym->getName() != prevFunc) {
-  //   DISASSMSG("<FUN %s\n", prevFunc.c_str());
-  //   prevFunc = sym->getName();
-  //   DISASSMSG("\n>FUN %s\n", sym->getName());
-  // }
-  // DISASSMSG("[%08x] (%08x) ", getPC(), instr);
+template <unsigned int F>
+bool Processor::execBGEU(const DecodedInstr *di) {
+  TRACEMSG("\tB-type | BGEU %s(%x),%s(%x),%d\n", regName[di->rs1],
+           regRead(di->rs1), regName[di->rs2], regRead(di->rs2), di->imm);
+  if (regRead(di->rs1) >= regRead(di->rs2))
+    setNextPC(getPC() + di->imm);
+  else
+    setNextPC(getPC() + WORDLEN);
+  return false;
+}
 
-  switch (opcode) {
-  case OP_L: {
-    e = execInstrL(instr);
-    break;
-  }
-  case R_TYPE: {
-    e = execInstrR(instr);
-    break;
-  }
-  case I_TYPE: {
-    e = execInstrI(instr);
-    break;
-  }
-  case I2_TYPE: {
-    e = execInstrI2(instr);
-    break;
-  }
-  case B_TYPE: {
-    e = execInstrB(instr);
-    break;
-  }
-  case S_TYPE: {
-    e = execInstrS(instr);
-    break;
-  }
-  case OP_AUIPC: {
-    DISASSMSG("\tU-type | AUIPC\n");
-    uint8_t rd = RD(instr);
-    SWord imm = U_IMM(instr);
-    imm = SIGN_EXTENSION(imm, I_IMM_SIZE);
-    regWrite(rd, (SWord)getPC() + imm);
+template <unsigned int F>
+bool Processor::execSB(const DecodedInstr *di) {
+  Word vaddr = (SWord)regRead(di->rs1) + di->imm;
+  Word paddr = 0;
+  TRACEMSG("\tS-type | SB %s(%x),%s(%x),%d\n", regName[di->rs2],
+           regRead(di->rs2), regName[di->rs1], regRead(di->rs1), di->imm);
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, WRITE)) {
+    // only the byte lane addressed is written
+    bool e =
+        bus->DataWrite(paddr, mergeByte(0, regRead(di->rs2), BYTEPOS(vaddr)),
+                       mergeByte(0, MAXWORDVAL, BYTEPOS(vaddr)), this);
     setNextPC(getPC() + WORDLEN);
-    break;
+    return e;
   }
-  case OP_LUI: {
-    uint8_t rd = RD(instr);
-    SWord imm = SIGN_EXTENSION(U_IMM(instr), U_IMM_SIZE) << 12;
-    DISASSMSG("\tU-type | LUI %s,%x\n", regName[rd], imm);
-    this->regWrite(rd, imm);
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execSH(const DecodedInstr *di) {
+  Word vaddr = (SWord)regRead(di->rs1) + di->imm;
+  Word paddr = 0;
+  Word old = 0;
+  TRACEMSG("\tS-type | SH %s(%x),%s(%x),%d -> %x\n", regName[di->rs2],
+           regRead(di->rs2), regName[di->rs1], regRead(di->rs1), di->imm,
+           old);
+  if (!mapVirtual<F>(ALIGN(vaddr), &paddr, WRITE)) {
+    // only the halfword lane addressed is written
+    bool e =
+        bus->DataWrite(paddr, mergeHWord(0, regRead(di->rs2), HWORDPOS(vaddr)),
+                       mergeHWord(0, MAXWORDVAL, HWORDPOS(vaddr)), this);
     setNextPC(getPC() + WORDLEN);
-    break;
-  }
-  case OP_JAL: {
-    uint8_t rd = RD(instr);
-    Word imm = SIGN_EXTENSION(J_IMM(instr), J_IMM_SIZE) & 0xfffffffe;
-    DISASSMSG("\tJ-type | JAL %s,%x\n", regName[rd], getPC() + imm);
-    regWrite(rd, getPC() + WORDLEN);
-    setNextPC(getPC() + imm);
-    break;
-  }
-  case OP_JALR: {
-    uint8_t rd = RD(instr);
-    uint8_t rs1 = RS1(instr);
-    Word imm = SIGN_EXTENSION(I_IMM(instr), I_IMM_SIZE);
-    DISASSMSG("\tJ-type | JALR %s,%s(%x),%x\n", regName[rd], regName[rs1],
-              regRead(rs1), (regRead(rs1) + imm) & 0xfffffffe);
-    regWrite(rd, getPC() + WORDLEN);
-    setNextPC(((regRead(rs1) + imm) & 0xfffffffe));
-    break;
-  }
-  default: {
-    ERRORMSG("OpCode not handled %x\n", instr);
-    SignalExc(EXC_II, 0);
-    e = true;
-    ERROR("opcode not handled");
-    break;
+    return e;
   }
+  return true;
+}
+
+template <unsigned int F>
+bool Processor::execSW(const DecodedInstr *di) {
+  Word vaddr = (SWord)regRead(di->rs1) + di->imm;
+  Word paddr = 0;
+  TRACEMSG("\tS-type | SW $(%s(%x)+%d)<-%s(%x)\n", regName[di->rs1],
+           regRead(di->rs1), di->imm, regName[di->rs2], regRead(di->rs2));
+  if (!mapVirtual<F>(vaddr, &paddr, WRITE) &&
+      !this->bus->DataWrite(paddr, regRead(di->rs2), this)) {
+    setNextPC(getPC() + WORDLEN);
+    return false;
   }
+  return true;
+}
 
-  return e;
+template <unsigned int F>
+bool Processor::execAUIPC(const DecodedInstr *di) {
+  TRACEMSG("\tU-type | AUIPC\n");
+  regWrite(di->rd, (SWord)getPC() + di->imm);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execLUI(const DecodedInstr *di) {
+  TRACEMSG("\tU-type | LUI %s,%x\n", regName[di->rd], di->imm);
+  this->regWrite(di->rd, di->imm);
+  setNextPC(getPC() + WORDLEN);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execJAL(const DecodedInstr *di) {
+  TRACEMSG("\tJ-type | JAL %s,%x\n", regName[di->rd], getPC() + di->imm);
+  regWrite(di->rd, getPC() + WORDLEN);
+  setNextPC(getPC() + di->imm);
+  return false;
+}
+
+template <unsigned int F>
+bool Processor::execJALR(const DecodedInstr *di) {
+  TRACEMSG("\tJ-type | JALR %s,%s(%x),%x\n", regName[di->rd],
+           regName[di->rs1], regRead(di->rs1),
+           (regRead(di->rs1) + di->imm) & 0xfffffffe);
+  regWrite(di->rd, getPC() + WORDLEN);
+  setNextPC(((regRead(di->rs1) + di->imm) & 0xfffffffe));
+  return false;
 }
 
 // This method scans the TLB looking for a entry that matches ASID/VPN pair;
@@ -1603,6 +2210,30 @@ bool Processor::probeTLB(unsigned int *index, Word asid, Word vpn) {
   return found;
 }
 
+// This method translates virtual address vaddr as mapVirtual() does,
+// but without any side effects: it returns false, instead of raising an
+// exception or updating the micro-TLB, if the translation fails or is
+// not cached
+bool Processor::peekVirtual(Word vaddr, Word *paddr, bool write) {
+  if (BADADDR(vaddr) ||
+      (InUserMode() && (INBOUNDS(vaddr, KSEG0BASE, KUSEGBASE))))
+    return false;
+
+  if (INBOUNDS(vaddr, KSEG0BASE, tlbFloorAddress)) {
+    *paddr = vaddr;
+    return true;
+  }
+
+  Word tag = VPN(vaddr) | ASID(csrEntryHi) | 1UL;
+  const MicroTLBEntry *mte = &microTLB[(vaddr >> 12) & (kMicroTLBSize - 1)];
+  if (mte->tag == tag && (!write || BitVal(mte->lo, DBITPOS))) {
+    *paddr = PHADDR(vaddr, mte->lo);
+    return true;
+  }
+
+  return false;
+}
+
 // This method sets delayed load handling variables when needed by
 // instruction execution
 void Processor::setLoad(LoadTargetType loadCode, unsigned int regNum,
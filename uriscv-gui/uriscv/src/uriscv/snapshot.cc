@@ -0,0 +1,120 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the SnapshotWriter and SnapshotReader classes,
+ * thin wrappers around stdio streams used to save and restore the
+ * Machine state.
+ *
+ ****************************************************************************/
+
+#include "uriscv/snapshot.h"
+
+#include "uriscv/blockdev_params.h"
+#include "uriscv/const.h"
+#include "uriscv/error.h"
+
+// Snapshot format version: it must be bumped whenever the state saved
+// by any component changes
+HIDDEN const Word kSnapshotVersion = 3;
+
+SnapshotWriter::SnapshotWriter(const std::string &fileName, bool buffered)
+    : fileName(fileName), buffered(buffered) {
+  if ((file = fopen(fileName.c_str(), "w")) == NULL)
+    throw FileError(fileName);
+
+  PutWord(SNAPFILEID);
+  PutWord(kSnapshotVersion);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (file != NULL)
+    fclose(file);
+}
+
+void SnapshotWriter::Put(const void *data, size_t size) {
+  if (buffered)
+    buffer.append((const char *)data, size);
+  else if (size > 0 && fwrite(data, size, 1, file) != 1)
+    throw FileError(fileName);
+}
+
+void SnapshotWriter::PutString(const std::string &s) {
+  PutWord(s.size());
+  Put(s.data(), s.size());
+}
+
+void SnapshotWriter::Close() {
+  bool failed = !buffer.empty() &&
+                fwrite(buffer.data(), buffer.size(), 1, file) != 1;
+  std::string().swap(buffer);
+
+  int res = fclose(file);
+  file = NULL;
+  if (failed || res != 0)
+    throw FileError(fileName);
+}
+
+SnapshotReader::SnapshotReader(const std::string &fileName)
+    : fileName(fileName) {
+  if ((file = fopen(fileName.c_str(), "r")) == NULL)
+    throw FileError(fileName);
+
+  Word tag;
+  if (fread(&tag, sizeof(tag), 1, file) != 1 || tag != SNAPFILEID) {
+    fclose(file);
+    throw InvalidFileFormatError(fileName, "Snapshot file expected");
+  }
+  Expect(kSnapshotVersion, "Unsupported snapshot version");
+}
+
+SnapshotReader::~SnapshotReader() { fclose(file); }
+
+void SnapshotReader::Get(void *data, size_t size) {
+  if (size > 0 && fread(data, size, 1, file) != 1) {
+    if (ferror(file))
+      throw ReadingError();
+    throw InvalidFileFormatError(fileName, "Truncated snapshot file");
+  }
+}
+
+Word SnapshotReader::GetWord() {
+  Word w;
+  Get(&w, sizeof(w));
+  return w;
+}
+
+uint64_t SnapshotReader::GetU64() {
+  uint64_t v;
+  Get(&v, sizeof(v));
+  return v;
+}
+
+std::string SnapshotReader::GetString() {
+  std::string s(GetWord(), '\0');
+  if (!s.empty())
+    Get(&s[0], s.size());
+  return s;
+}
+
+void SnapshotReader::Expect(Word expected, const char *what) {
+  if (GetWord() != expected)
+    throw InvalidFileFormatError(fileName, what);
+}
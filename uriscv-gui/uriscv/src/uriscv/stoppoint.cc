@@ -31,6 +31,8 @@ std::string Stoppoint::ToString() const {
                     range.getASID() % range.getStart() % range.getEnd());
 }
 
+StoppointSet::StoppointSet() : pageFilter(kFilterBits / 32) {}
+
 StoppointSet::~StoppointSet() {}
 
 Stoppoint *StoppointSet::Find(Word asid, Word addr) {
@@ -59,8 +61,10 @@ bool StoppointSet::Add(const AddressRange &range, AccessMode mode,
   // No overlap: safe to add
   Stoppoint *p = new Stoppoint(std::max(id, nextId()), range, mode);
   p->SetEnabled(enabled);
+  p->index = points.size();
   points.push_back(Stoppoint::Ptr(p));
   addressMap[p->getRange()] = p;
+  addToFilter(p->getRange());
 
   SignalStoppointInserted();
   return true;
@@ -76,6 +80,9 @@ void StoppointSet::Remove(size_t index) {
   addressMap.erase(it);
 
   points.erase(points.begin() + index);
+  for (size_t i = index; i < points.size(); i++)
+    points[i]->index = i;
+  rebuildFilter();
 
   SignalStoppointRemoved(index);
 }
@@ -83,6 +90,7 @@ void StoppointSet::Remove(size_t index) {
 void StoppointSet::Clear() {
   addressMap.clear();
   points.clear();
+  rebuildFilter();
 }
 
 void StoppointSet::SetEnabled(size_t index, bool setting) {
@@ -98,6 +106,25 @@ Stoppoint *StoppointSet::Probe(Word asid, Word addr, AccessMode mode,
   if (IsEmpty())
     return NULL;
 
+  Stoppoint *p = lookup(asid, addr, mode);
+  if (p == NULL && asid != MAXASID)
+    p = lookup(ANYASID, addr, mode);
+
+  if (p != NULL)
+    SignalHit.emit(p->getIndex(), p, addr, cpu);
+  return p;
+}
+
+bool StoppointSet::MayCoverPage(Word asid, Word addr) const {
+  return !IsEmpty() &&
+         (filterHas(asid, addr) ||
+          (asid != MAXASID && filterHas(ANYASID, addr)));
+}
+
+Stoppoint *StoppointSet::lookup(Word asid, Word addr, AccessMode mode) const {
+  if (!filterHas(asid, addr))
+    return NULL;
+
   AddressRange range(asid, addr, addr);
   StoppointMap::const_iterator it = addressMap.lower_bound(range);
   if (it == addressMap.end() ||
@@ -106,17 +133,7 @@ Stoppoint *StoppointSet::Probe(Word asid, Word addr, AccessMode mode,
   }
   Stoppoint *p = it->second;
 
-  if (p->Matches(asid, addr, mode)) {
-    size_t index = 0;
-    for (index = 0; index < points.size(); ++index)
-      if (points[index].get() == p)
-        break;
-    assert(index < points.size());
-    SignalHit.emit(index, p, addr, cpu);
-    return p;
-  } else {
-    return NULL;
-  }
+  return p->Matches(asid, addr, mode) ? p : NULL;
 }
 
 std::string StoppointSet::ToString(bool sorted) const {
@@ -143,6 +160,28 @@ std::string StoppointSet::ToString(bool sorted) const {
   return result.append("]");
 }
 
+void StoppointSet::addToFilter(const AddressRange &range) {
+  const Word first = range.getStart() >> kFilterPageShift;
+  const Word last = range.getEnd() >> kFilterPageShift;
+
+  if (last - first >= kFilterBits - 1) {
+    std::fill(pageFilter.begin(), pageFilter.end(), ~0U);
+    return;
+  }
+  for (Word page = first;; page++) {
+    const unsigned int bit = filterBit(range.getASID(), page);
+    pageFilter[bit / 32] |= 1U << (bit % 32);
+    if (page == last)
+      break;
+  }
+}
+
+void StoppointSet::rebuildFilter() {
+  std::fill(pageFilter.begin(), pageFilter.end(), 0U);
+  for (const Stoppoint::Ptr &p : points)
+    addToFilter(p->getRange());
+}
+
 unsigned int StoppointSet::nextId() const {
   unsigned int id = 0;
   for (Stoppoint::Ptr p : points)
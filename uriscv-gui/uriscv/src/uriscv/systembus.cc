@@ -47,20 +47,25 @@
 
 #include <assert.h>
 
+#include <boost/bind/bind.hpp>
+
 #include "uriscv/arch.h"
 #include "uriscv/blockdev.h"
 #include "uriscv/blockdev_params.h"
 #include "uriscv/const.h"
 #include "uriscv/cpu.h"
+#include "uriscv/decode_cache.h"
 #include "uriscv/device.h"
 #include "uriscv/error.h"
 #include "uriscv/event.h"
+#include "uriscv/jit.h"
 #include "uriscv/machine.h"
 #include "uriscv/machine_config.h"
 #include "uriscv/memspace.h"
 #include "uriscv/mp_controller.h"
 #include "uriscv/mpic.h"
 #include "uriscv/processor.h"
+#include "uriscv/snapshot.h"
 #include "uriscv/time_stamp.h"
 #include "uriscv/types.h"
 #include "uriscv/utility.h"
@@ -68,6 +73,12 @@
 // This macro converts a byte address into a word address (minus offset)
 #define CONVERT(ad, bs) ((ad - bs) >> WORDSHIFT)
 
+// This macro converts a byte address into a word offset inside its page
+#define PAGEOFS(ad) ((ad & ((1UL << kPageShift) - 1)) >> WORDSHIFT)
+
+const Word *SystemBus::noReadTable[SystemBus::kTableSize];
+Word *SystemBus::noWriteTable[SystemBus::kTableSize];
+
 class DeviceAreaAddress {
 public:
   DeviceAreaAddress(Word paddr) : pa(paddr) {
@@ -94,11 +105,20 @@ private:
 
 SystemBus::SystemBus(const MachineConfig *conf, Machine *machine)
     : config(conf), machine(machine), pic(new InterruptController(conf, this)),
-      mpController(new MPController(conf, machine)) {
+      mpController(new MPController(conf, machine)), replaying(false),
+      codePages(new uint32_t[kNumPages / 32]()), parallel(false),
+      codeStale(false) {
   tod = UINT64_C(0);
-  timer = MAXWORDVAL;
+  setTimer(MAXWORDVAL);
+  clockWatched = true;
   eventQ = new EventQueue();
 
+  for (unsigned int i = 0; i < config->getNumProcessors(); i++)
+    decodeCaches.push_back(new DecodeCache(codePages.get()));
+
+  if (JIT && Jit::IsSupported())
+    jit.reset(new Jit(this));
+
   const char *coreFile = NULL;
   if (config->isLoadCoreEnabled())
     coreFile = config->getROM(ROM_TYPE_CORE).c_str();
@@ -108,6 +128,15 @@ SystemBus::SystemBus(const MachineConfig *conf, Machine *machine)
   bios = new BiosSpace(config->getROM(ROM_TYPE_BIOS).c_str());
   boot = new BiosSpace(config->getROM(ROM_TYPE_BOOT).c_str());
 
+  for (unsigned int i = 0; i < kDirSize; i++) {
+    readDir[i] = noReadTable;
+    writeDir[i] = noWriteTable;
+  }
+  allocMap(RAMBASE, ram->Size());
+  allocMap(BIOSDATABASE, biosdata->Size());
+  allocMap(BIOSBASE, bios->Size());
+  allocMap(BOOTBASE, boot->Size());
+
   // Create devices and initialize registers used for interrupt
   // handling.
   intPendMask = 0UL;
@@ -119,17 +148,29 @@ SystemBus::SystemBus(const MachineConfig *conf, Machine *machine)
         instDevTable[intl] = SetBit(instDevTable[intl], devNo);
     }
   }
+
+  MapPages();
 }
 
 // This method deletes a SystemBus object and all related structures
 SystemBus::~SystemBus() {
   delete eventQ;
 
+  for (DecodeCache *dc : decodeCaches)
+    delete dc;
+
   delete ram;
   delete biosdata;
   delete bios;
   delete boot;
 
+  for (unsigned int i = 0; i < kDirSize; i++) {
+    if (readDir[i] != noReadTable) {
+      delete[] readDir[i];
+      delete[] writeDir[i];
+    }
+  }
+
   for (unsigned int intl = 0; intl < DEVINTUSED; intl++)
     for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++)
       delete devTable[intl][dnum];
@@ -139,58 +180,92 @@ SystemBus::~SystemBus() {
 // on timer underflow (0 -> FFFFFFFF transition) a interrupt is
 // generated.  Event queue is checked against the current clock value
 // and device operations are completed if needed; all memory changes
-// are notified to Watch control object
+// are notified to Watch control object, if it is watching them
 void SystemBus::ClockTick() {
   tod++;
 
-  // both registers signal "change" because they are conceptually one
-  machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
-  machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
-
-  // Update interval timer
-  if (UnsSub(&timer, timer, 1)) {
+  // Interval timer underflow
+  if (tod == timerDeadline) {
     pic->StartIRQ(IL_TIMER);
+    timerDeadline += UINT64_C(1) << 32;
   }
-  machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 
-  // Scan the event queue
-  while (!eventQ->IsEmpty() && eventQ->nextDeadline() <= tod) {
-    (eventQ->nextCallback())();
-    eventQ->RemoveHead();
+  if (clockWatched)
+    notifyClockChange();
+
+  // Inputs from outside go before the events due at the same time
+  while (!pendingInputs.empty() && pendingInputs.front().tick <= tod) {
+    ExternalInput input = pendingInputs.front();
+    pendingInputs.pop_front();
+    applyInput(input);
   }
+
+  // Scan the event queue
+  while (!eventQ->IsEmpty() && eventQ->nextDeadline() <= tod)
+    eventQ->RunHead();
 }
 
 uint32_t SystemBus::IdleCycles() const {
-  if (eventQ->IsEmpty())
+  const Word timer = getTimer();
+  if (eventQ->IsEmpty() && pendingInputs.empty())
     return timer;
 
-  const uint64_t et = eventQ->nextDeadline();
+  uint64_t et = UINT64_MAX;
+  if (!eventQ->IsEmpty())
+    et = eventQ->nextDeadline();
+  if (!pendingInputs.empty())
+    et = std::min(et, pendingInputs.front().tick);
   if (et > tod)
-    return std::min(timer, (uint32_t)(et - tod - 1));
+    return std::min((uint64_t)timer, et - tod - 1);
   else
     return 0;
 }
 
 void SystemBus::Skip(uint32_t cycles) {
   tod += cycles;
+  if (clockWatched)
+    notifyClockChange();
+}
+
+// This method notifies Watch that the clock registers have changed
+void SystemBus::notifyClockChange() {
+  // both registers signal "change" because they are conceptually one
   machine->HandleBusAccess(BUS_REG_TOD_HI, WRITE, NULL);
   machine->HandleBusAccess(BUS_REG_TOD_LO, WRITE, NULL);
-
-  timer -= cycles;
   machine->HandleBusAccess(BUS_REG_TIMER, WRITE, NULL);
 }
 
-void SystemBus::setToDHI(Word hi) { TimeStamp::setHi(tod, hi); }
+// The interval timer is not decremented on each clock tick: it is kept
+// as the clock value it underflows at (timerDeadline), so that its
+// current value can be computed when needed
 
-void SystemBus::setToDLO(Word lo) { TimeStamp::setLo(tod, lo); }
+Word SystemBus::getTimer() const { return (Word)(timerDeadline - tod - 1); }
 
-void SystemBus::setTimer(Word time) { timer = time; }
+void SystemBus::setToDHI(Word hi) {
+  const Word timer = getTimer();
+  TimeStamp::setHi(tod, hi);
+  setTimer(timer);
+}
+
+void SystemBus::setToDLO(Word lo) {
+  const Word timer = getTimer();
+  TimeStamp::setLo(tod, lo);
+  setTimer(timer);
+}
+
+void SystemBus::setTimer(Word time) { timerDeadline = tod + 1 + time; }
 
 // This method reads a data word from memory at address addr, returning it
 // thru datap pointer. It also returns TRUE if the address was invalid and
 // an exception was caused, FALSE otherwise, and signals memory access to
 // Watch control object
 bool SystemBus::DataRead(Word addr, Word *datap, Processor *cpu) {
+  const Word *page = readMap(addr >> kPageShift);
+  if (page != NULL) {
+    *datap = __atomic_load_n(&page[PAGEOFS(addr)], __ATOMIC_RELAXED);
+    return false;
+  }
+
   machine->HandleBusAccess(addr, READ, cpu);
 
   if (busRead(addr, datap, cpu)) {
@@ -216,11 +291,65 @@ bool SystemBus::WatchWrite(Word addr, Word data) {
   return busWrite(addr, data, machine->getProcessor(0));
 }
 
+// Memory words hold their bytes in little-endian order, whatever the
+// host byte order is
+size_t SystemBus::DebugRead(Word addr, uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    const Word a = addr + done;
+    const Word *page = readMap(a >> kPageShift);
+    if (page != NULL) {
+      // Copy up to the end of the page without going through the bus
+      const size_t n =
+          std::min(len - done, (size_t)(kPageSize - a % kPageSize));
+      for (size_t i = 0; i < n; i++) {
+        const Word b = a + i;
+        buf[done + i] = page[PAGEOFS(b)] >> (b % WORDLEN * 8);
+      }
+      done += n;
+    } else {
+      Word w;
+      if (busRead(a - a % WORDLEN, &w, machine->getProcessor(0)))
+        break;
+      const size_t n = std::min(len - done, (size_t)(WORDLEN - a % WORDLEN));
+      for (size_t i = 0; i < n; i++)
+        buf[done + i] = w >> ((a + i) % WORDLEN * 8);
+      done += n;
+    }
+  }
+  return done;
+}
+
+size_t SystemBus::DebugWrite(Word addr, const uint8_t *buf, size_t len) {
+  size_t done = 0;
+  while (done < len) {
+    const Word a = addr + done;
+    const size_t n = std::min(len - done, (size_t)(WORDLEN - a % WORDLEN));
+    Word data = 0, mask = 0;
+    for (size_t i = 0; i < n; i++) {
+      const unsigned int shift = (a + i) % WORDLEN * 8;
+      data |= (Word)buf[done + i] << shift;
+      mask |= (Word)0xFF << shift;
+    }
+    if (busWrite(a - a % WORDLEN, data, machine->getProcessor(0), mask))
+      break;
+    done += n;
+  }
+  return done;
+}
+
 // This method writes the data word at physical addr in RAM memory or device
 // register area.  Writes to BIOS or BOOT areas cause a DBEXCEPTION (no
 // writes allowed). It returns TRUE if an exception was caused, FALSE
 // otherwise, and notifies access to Watch control object
 bool SystemBus::DataWrite(Word addr, Word data, Processor *proc) {
+  Word *page = writeMap(addr >> kPageShift);
+  if (page != NULL) {
+    __atomic_store_n(&page[PAGEOFS(addr)], data, __ATOMIC_RELAXED);
+    invalidateCode(addr);
+    return false;
+  }
+
   machine->HandleBusAccess(addr, WRITE, proc);
 
   if (busWrite(addr, data, proc)) {
@@ -231,6 +360,36 @@ bool SystemBus::DataWrite(Word addr, Word data, Processor *proc) {
   return false;
 }
 
+// This method writes the bytes of data selected by mask (a byte or
+// halfword lane) to the word at physical addr, leaving the other ones
+// untouched; it signals exceptions and notifies Watch as DataWrite()
+bool SystemBus::DataWrite(Word addr, Word data, Word mask, Processor *proc) {
+  Word *page = writeMap(addr >> kPageShift);
+  if (page != NULL) {
+    Word *word = &page[PAGEOFS(addr)];
+    if (parallel) {
+      // other processors may be writing other lanes of the same word
+      Word old = __atomic_load_n(word, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(word, &old,
+                                          (old & ~mask) | (data & mask), true,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    } else {
+      *word = (*word & ~mask) | (data & mask);
+    }
+    invalidateCode(addr);
+    return false;
+  }
+
+  machine->HandleBusAccess(addr, WRITE, proc);
+
+  if (busWrite(addr, data, proc, mask)) {
+    proc->SignalExc(EXC_SAF);
+    return true;
+  }
+  return false;
+}
+
 // This method transfers a block from or to memory, starting with address
 // startAddr; it returns TRUE is transfer was not successful (non-existent
 // memory, read-only memory, unaligned addresses), FALSE otherwise.
@@ -297,6 +456,12 @@ bool SystemBus::DMAVarTransfer(Block *blk, Word startAddr, Word byteLength,
 // it thru istrp pointer. It also returns TRUE if the address was invalid and
 // an exception was caused, FALSE otherwise, and notifies Watch
 bool SystemBus::InstrRead(Word addr, Word *instrp, Processor *proc) {
+  const Word *page = readMap(addr >> kPageShift);
+  if (page != NULL) {
+    *instrp = __atomic_load_n(&page[PAGEOFS(addr)], __ATOMIC_RELAXED);
+    return false;
+  }
+
   machine->HandleBusAccess(addr, EXEC, proc);
 
   if (busRead(addr, instrp)) {
@@ -310,6 +475,12 @@ bool SystemBus::InstrRead(Word addr, Word *instrp, Processor *proc) {
 }
 
 bool SystemBus::InstrReadGDB(Word addr, Word *instrp, Processor *proc) {
+  const Word *page = readMap(addr >> kPageShift);
+  if (page != NULL) {
+    *instrp = __atomic_load_n(&page[PAGEOFS(addr)], __ATOMIC_RELAXED);
+    return false;
+  }
+
   if (busRead(addr, instrp)) {
     // address invalid: signal exception to processor
     return true;
@@ -319,10 +490,247 @@ bool SystemBus::InstrReadGDB(Word addr, Word *instrp, Processor *proc) {
   }
 }
 
+// This method maps all RAM and ROM pages for direct access; device
+// register pages are left to busRead() and busWrite(). Pages outside
+// the memory spaces are never mapped, so only these are rewritten
+void SystemBus::MapPages() {
+  mapSpace(RAMBASE, ram->Size(), ram->MemPtr(0), ram->MemPtr(0));
+  for (Word page = 0; page < ram->Size() >> kPageShift; page++)
+    if (!ram->IsDirty(page))
+      writeMap((RAMBASE >> kPageShift) + page) = NULL;
+  mapSpace(BIOSDATABASE, biosdata->Size(), biosdata->MemPtr(0),
+           biosdata->MemPtr(0));
+  mapSpace(BIOSBASE, bios->Size(), bios->MemPtr(0), NULL);
+  mapSpace(BOOTBASE, boot->Size(), boot->MemPtr(0), NULL);
+}
+
+// This method unmaps the pages in the physical address range [start,
+// end], forcing accesses to them through the slow path
+void SystemBus::UnmapPages(Word start, Word end) {
+  for (Word pfn = start >> kPageShift; pfn <= (end >> kPageShift); pfn++) {
+    // Pages without a table are not mapped anyway
+    if (readDir[pfn >> (kTableShift - kPageShift)] == noReadTable)
+      continue;
+    readMap(pfn) = NULL;
+    writeMap(pfn) = NULL;
+  }
+}
+
+void SystemBus::setParallel(bool enabled) {
+  parallel = enabled;
+  if (!parallel && codeStale) {
+    for (DecodeCache *dc : decodeCaches)
+      dc->Flush();
+    codeStale = false;
+  }
+}
+
+bool SystemBus::ParallelSafe(Word addr, bool write) const {
+  const Word pfn = addr >> kPageShift;
+  if (!write)
+    return readMap(pfn) != NULL;
+
+  return writeMap(pfn) != NULL &&
+         !(__atomic_load_n(&codePages[pfn >> 5], __ATOMIC_RELAXED) &
+           (1U << (pfn & 31))) &&
+         !(jit && jit->HasCode(addr));
+}
+
+// This method keeps the decoded instruction caches and the JIT coherent
+// with a write to the word at physical address addr.
+// Processors running in parallel only write to pages without code (see
+// ParallelSafe()), and the caches of the others must not be touched
+// meanwhile; still, another processor may have started fetching from
+// the page after the check, and the write may have raced with it
+void SystemBus::invalidateCode(Word addr) {
+  const Word pfn = addr >> kPageShift;
+  if (parallel) {
+    // Pairs with the marking of new pages in DecodeCache
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&codePages[pfn >> 5], __ATOMIC_RELAXED) &
+        (1U << (pfn & 31)))
+      __atomic_store_n(&codeStale, true, __ATOMIC_RELAXED);
+    return;
+  }
+
+  if (codePages[pfn >> 5] & (1U << (pfn & 31))) {
+    for (DecodeCache *dc : decodeCaches)
+      dc->Invalidate(addr);
+  }
+  if (jit)
+    jit->Invalidate(addr);
+}
+
 // This method inserts in the eventQ a event that must happen
 // at (current system time) + delay
-uint64_t SystemBus::scheduleEvent(uint64_t delay, Event::Callback callback) {
-  return eventQ->InsertQ(tod, delay, callback);
+uint64_t SystemBus::scheduleEvent(uint64_t delay, const EventTag &tag) {
+  return eventQ->InsertQ(tod, delay, tag, eventCallback(tag));
+}
+
+Event::Callback SystemBus::eventCallback(const EventTag &tag) {
+  switch (tag.type) {
+  case EventTag::ET_DEVICE_OP:
+    return boost::bind(&Device::CompleteDevOp, getDev(tag.arg[0], tag.arg[1]));
+
+  case EventTag::ET_CPU_RESET:
+    assert(tag.arg[0] < config->getNumProcessors());
+    return boost::bind(&Processor::Reset, machine->getProcessor(tag.arg[0]),
+                       tag.arg[1], tag.arg[2]);
+
+  case EventTag::ET_CPU_HALT:
+    assert(tag.arg[0] < config->getNumProcessors());
+    return boost::bind(&Processor::Halt, machine->getProcessor(tag.arg[0]));
+
+  case EventTag::ET_POWEROFF:
+    return boost::bind(&Machine::Halt, machine);
+
+  case EventTag::ET_IPI:
+    return boost::bind(&InterruptController::DeliverIPI, pic.get(),
+                       tag.arg[0], tag.arg[1]);
+
+  default:
+    Panic("Unknown event type in SystemBus::eventCallback()");
+    // never returns
+    return Event::Callback();
+  }
+}
+
+void SystemBus::Save(SnapshotWriter &out, bool ramDirtyOnly) const {
+  out.PutU64(tod);
+  out.PutU64(timerDeadline);
+  out.PutWord(intPendMask);
+
+  ram->Save(out, ramDirtyOnly);
+  biosdata->Save(out);
+
+  eventQ->Save(out);
+  pic->Save(out);
+  mpController->Save(out);
+
+  out.PutWord(pendingInputs.size());
+  for (const ExternalInput &input : pendingInputs) {
+    out.PutU64(input.tick);
+    out.PutWord(input.type);
+    out.PutWord(input.il);
+    out.PutWord(input.devNo);
+    out.PutBool(input.working);
+    out.PutString(input.text);
+  }
+
+  for (unsigned int intl = 0; intl < DEVINTUSED; intl++) {
+    for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++) {
+      out.PutWord(devTable[intl][dnum]->Type());
+      devTable[intl][dnum]->Save(out);
+    }
+  }
+}
+
+void SystemBus::Restore(SnapshotReader &in) {
+  tod = in.GetU64();
+  timerDeadline = in.GetU64();
+  intPendMask = in.GetWord();
+
+  ram->Restore(in);
+  biosdata->Restore(in);
+
+  eventQ->Restore(in, boost::bind(&SystemBus::eventCallback, this,
+                                  boost::placeholders::_1));
+  pic->Restore(in);
+  mpController->Restore(in);
+
+  pendingInputs.clear();
+  for (Word n = in.GetWord(); n > 0; n--) {
+    ExternalInput input;
+    input.tick = in.GetU64();
+    input.type = in.GetWord();
+    input.il = in.GetWord();
+    input.devNo = in.GetWord();
+    input.working = in.GetBool();
+    input.text = in.GetString();
+    if (input.type > ExternalInput::EI_CONDITION || input.il >= DEVINTUSED ||
+        input.devNo >= DEVPERINT)
+      throw InvalidFileFormatError(in.getFileName(), "Invalid pending input");
+    pendingInputs.push_back(input);
+  }
+
+  for (unsigned int intl = 0; intl < DEVINTUSED; intl++) {
+    for (unsigned int dnum = 0; dnum < DEVPERINT; dnum++) {
+      in.Expect(devTable[intl][dnum]->Type(),
+                "Snapshot devices do not match the machine configuration");
+      devTable[intl][dnum]->Restore(in);
+    }
+  }
+
+  // Memory has changed under the caches' feet
+  for (DecodeCache *dc : decodeCaches)
+    dc->Flush();
+  if (jit)
+    jit->Flush();
+}
+
+void SystemBus::ClearDirtyPages() {
+  ram->ClearDirty();
+  for (Word page = 0; page < ram->Size() >> kPageShift; page++)
+    writeMap((RAMBASE >> kPageShift) + page) = NULL;
+}
+
+void SystemBus::TerminalInput(unsigned int devNo, const std::string &text) {
+  ExternalInput input(ExternalInput::EI_TERMINAL, EXT_IL_INDEX(IL_TERMINAL),
+                      devNo);
+  input.text = text;
+  injectInput(input);
+}
+
+void SystemBus::setDeviceCondition(unsigned int il, unsigned int devNo,
+                                   bool working) {
+  ExternalInput input(ExternalInput::EI_CONDITION, il, devNo);
+  input.working = working;
+  injectInput(input);
+}
+
+void SystemBus::RecordInputs(const std::string &fileName) {
+  inputLog.reset(new InputLog(fileName));
+  replaying = false;
+}
+
+void SystemBus::ReplayInputs(const std::string &fileName) {
+  std::vector<ExternalInput> inputs = InputLog::Read(fileName);
+
+  // Inputs up to now have been applied already (e.g. before the
+  // snapshot the machine was restored from was taken)
+  pendingInputs.clear();
+  for (const ExternalInput &input : inputs)
+    if (input.tick > tod)
+      pendingInputs.push_back(input);
+
+  inputLog.reset();
+  replaying = true;
+}
+
+void SystemBus::injectInput(ExternalInput input) {
+  if (replaying)
+    return;
+
+  if (!inputLog) {
+    applyInput(input);
+    return;
+  }
+
+  input.tick = tod + 1;
+  inputLog->Write(input);
+
+  std::deque<ExternalInput>::iterator it = pendingInputs.end();
+  while (it != pendingInputs.begin() && (it - 1)->tick > input.tick)
+    --it;
+  pendingInputs.insert(it, input);
+}
+
+void SystemBus::applyInput(const ExternalInput &input) {
+  Device *device = getDev(input.il, input.devNo);
+  if (input.type == ExternalInput::EI_TERMINAL)
+    device->Input(input.text.c_str());
+  else
+    device->setCondition(input.working);
 }
 
 void SystemBus::IntReq(unsigned int intl, unsigned int devNum) {
@@ -419,7 +827,7 @@ Word SystemBus::busRegRead(Word addr, Processor *cpu) {
       data = getToDLO();
       break;
     case BUS_REG_TIMER:
-      data = timer;
+      data = getTimer();
       break;
     case BUS_REG_RAM_BASE:
       data = RAMBASE;
@@ -489,15 +897,60 @@ Device *SystemBus::makeDev(unsigned int intl, unsigned int dnum) {
   return dev;
 }
 
+// This method allocates the page map tables covering a memory space of
+// size bytes at physical address base
+void SystemBus::allocMap(Word base, Word size) {
+  if (size == 0)
+    return;
+  for (Word i = base >> kTableShift; i <= (base + size - 1) >> kTableShift;
+       i++) {
+    if (readDir[i] == noReadTable) {
+      readDir[i] = new const Word *[kTableSize]();
+      writeDir[i] = new Word *[kTableSize]();
+    }
+  }
+}
+
+// This method maps the full pages of a memory space of size bytes at
+// physical address base, backed by host memory at mem (writeMem is the
+// same memory for RAM, and NULL for ROM)
+void SystemBus::mapSpace(Word base, Word size, const Word *mem,
+                         Word *writeMem) {
+  const Word pageWords = (1U << kPageShift) / WORDLEN;
+  for (Word i = 0; i < size >> kPageShift; i++) {
+    readMap((base >> kPageShift) + i) = mem + i * pageWords;
+    if (writeMem != NULL)
+      writeMap((base >> kPageShift) + i) = writeMem + i * pageWords;
+  }
+}
+
 // This method writes the data at the physical address addr, and passes it
 // back thru the datap pointer. It also return FALSE if the addr is valid
 // and writable, and TRUE otherwise
-bool SystemBus::busWrite(Word addr, Word data, Processor *cpu) {
+bool SystemBus::busWrite(Word addr, Word data, Processor *cpu, Word mask) {
   if (INBOUNDS(addr, RAMBASE, RAMBASE + ram->Size())) {
-    ram->MemWrite(CONVERT(addr, RAMBASE), data);
+    ram->MemWrite(CONVERT(addr, RAMBASE), data, mask);
+    invalidateCode(addr);
+
+    // The page is dirty now: map it for writing again, unless Watch
+    // is interested in it
+    const Word pfn = addr >> kPageShift;
+    if (writeMap(pfn) == NULL && readMap(pfn) != NULL)
+      writeMap(pfn) =
+          ram->MemPtr(CONVERT(addr, RAMBASE) & ~(RamSpace::kPageWords - 1));
   } else if (INBOUNDS(addr, BIOSDATABASE, BIOSDATABASE + biosdata->Size())) {
-    biosdata->MemWrite(CONVERT(addr, BIOSDATABASE), data);
+    biosdata->MemWrite(CONVERT(addr, BIOSDATABASE), data, mask);
+    invalidateCode(addr);
   } else if (INBOUNDS(addr, MMIO_BASE, MMIO_END)) {
+    // registers are only word-sized: partial writes update them with
+    // their current contents merged in
+    if (mask != MAXWORDVAL) {
+      Word old;
+      if (busRead(addr, &old, cpu))
+        return true;
+      data = (old & ~mask) | (data & mask);
+    }
+
     if (DEV_REG_START <= addr && addr < DEV_REG_END) {
       DeviceAreaAddress dva(addr);
       Device *device = devTable[dva.line()][dva.device()];
@@ -511,7 +964,7 @@ bool SystemBus::busWrite(Word addr, Word data, Processor *cpu) {
       // data write is in bus registers area
       if (addr == BUS_REG_TIMER) {
         // update the interval timer and reset its interrupt line
-        timer = data;
+        setTimer(data);
         pic->EndIRQ(IL_TIMER);
       }
       // else data write is on a read only bus register, and
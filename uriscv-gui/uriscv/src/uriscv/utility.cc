@@ -15,6 +15,9 @@
 
 bool DEBUG = false;
 bool DISASS = false;
+bool JIT = false;
+bool JITCHECK = false;
+bool PARALLEL = false;
 
 void Utility::readFile(std::string filename, char *&dst, Word *size) {
   std::ifstream file(filename,
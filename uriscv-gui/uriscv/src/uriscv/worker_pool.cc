@@ -0,0 +1,82 @@
+/*
+ * uRISCV - A general purpose computer system simulator
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301,
+ * USA.
+ */
+
+/****************************************************************************
+ *
+ * This module implements the WorkerPool class. Threads wait on a
+ * condition variable for a new generation of work to be published, run
+ * the task on their own index and report back; Run() returns once the
+ * last one has.
+ *
+ ****************************************************************************/
+
+#include "uriscv/worker_pool.h"
+
+WorkerPool::WorkerPool(unsigned int size)
+    : task(NULL), generation(0), running(0), quit(false) {
+  for (unsigned int i = 1; i < size; i++)
+    workers.push_back(std::thread(&WorkerPool::workerMain, this, i));
+}
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    quit = true;
+  }
+  started.notify_all();
+  for (std::thread &t : workers)
+    t.join();
+}
+
+void WorkerPool::Run(const Task &t) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = &t;
+    generation++;
+    running = workers.size();
+  }
+  started.notify_all();
+
+  t(0);
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (running > 0)
+    finished.wait(lock);
+  task = NULL;
+}
+
+void WorkerPool::workerMain(unsigned int index) {
+  uint64_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  for (;;) {
+    while (!quit && generation == seen)
+      started.wait(lock);
+    if (quit)
+      return;
+    seen = generation;
+
+    const Task *t = task;
+    lock.unlock();
+    (*t)(index);
+    lock.lock();
+
+    if (--running == 0)
+      finished.notify_one();
+  }
+}